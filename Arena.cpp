@@ -0,0 +1,40 @@
+// c47edit - Scene editor for HM C47
+// Copyright (C) 2018-2022 AdrienTD
+// Licensed under the GPL3+.
+// See LICENSE file for more details.
+
+#include "Arena.h"
+#include <cassert>
+
+Arena::~Arena()
+{
+	for (void* block : blocks)
+		::operator delete(block, std::align_val_t(maxAlignment));
+}
+
+void* Arena::newBlock(size_t size)
+{
+	void* block = ::operator new(size, std::align_val_t(maxAlignment));
+	blocks.push_back(block);
+	return block;
+}
+
+void* Arena::allocate(size_t size, size_t alignment)
+{
+	assert(alignment <= maxAlignment);
+	std::lock_guard<std::mutex> lock(mutex);
+	++numLiveAllocations;
+
+	// big buffers get their own block, so that the current block isn't wasted
+	if (size > blockSize / 4)
+		return newBlock(size);
+
+	uint8_t* aligned = (uint8_t*)(((uintptr_t)blockCur + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	if (!blockCur || aligned + size > blockEnd) {
+		blockCur = (uint8_t*)newBlock(blockSize);
+		blockEnd = blockCur + blockSize;
+		aligned = blockCur;
+	}
+	blockCur = aligned + size;
+	return aligned;
+}
@@ -0,0 +1,43 @@
+// c47edit - Scene editor for HM C47
+// Copyright (C) 2018-2022 AdrienTD
+// Licensed under the GPL3+.
+// See LICENSE file for more details.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "DynArray.h"
+
+// Bump allocator giving buffers from big blocks, which are all freed together when the arena is destroyed.
+// Can be used by several threads at once, e.g. by the packs loaded in parallel.
+class Arena : public BufferAllocator
+{
+public:
+	static constexpr size_t maxAlignment = 64;
+
+	explicit Arena(size_t blockSize = 4 << 20) : blockSize(blockSize) {}
+	~Arena();
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	void* allocate(size_t size, size_t alignment) override;
+	void deallocate(void*, size_t, size_t) override { --numLiveAllocations; } // freed with the arena
+
+	size_t getNumBlocks() const { std::lock_guard<std::mutex> lock(mutex); return blocks.size(); }
+	// Allocations not deallocated yet, which must all be gone before the arena is destroyed
+	size_t getNumLiveAllocations() const { return numLiveAllocations; }
+
+private:
+	void* newBlock(size_t size);
+
+	mutable std::mutex mutex;
+	std::vector<void*> blocks;
+	uint8_t* blockCur = nullptr;
+	uint8_t* blockEnd = nullptr;
+	size_t blockSize;
+	std::atomic<size_t> numLiveAllocations = 0;
+};
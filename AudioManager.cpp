@@ -2,24 +2,24 @@
 #include <cassert>
 
 template <typename T>
-static void mdcReadTo(const Chunk::DataBuffer*& chkDataIt, T& val)
+static void mdcReadTo(ChunkView::MultidataIterator& chkDataIt, T& val)
 {
 	static_assert(std::is_arithmetic_v<T>);
-	val = *(const T*)chkDataIt->data();
+	val = *(const T*)(*chkDataIt).data();
 	++chkDataIt;
 }
 
 template <>
-static void mdcReadTo(const Chunk::DataBuffer*& chkDataIt, std::string& val)
+static void mdcReadTo(ChunkView::MultidataIterator& chkDataIt, std::string& val)
 {
-	val = (const char*)chkDataIt->data();
+	val = (const char*)(*chkDataIt).data();
 	++chkDataIt;
 }
 
 template <>
-static void mdcReadTo(const Chunk::DataBuffer*& chkDataIt, AudioRef& val)
+static void mdcReadTo(ChunkView::MultidataIterator& chkDataIt, AudioRef& val)
 {
-	val.id = *(const uint32_t*)chkDataIt->data();
+	val.id = *(const uint32_t*)(*chkDataIt).data();
 	++chkDataIt;
 }
 
@@ -51,8 +51,8 @@ static void mdcWrite(Chunk& chunk, const AudioRef& val)
 static constexpr uint32_t byteSwap32(uint32_t v) { return ((v & 0xFF) << 24) | ((v & 0xFF00) << 8) | ((v & 0xFF0000) >> 8) | (v >> 24); };
 
 struct RLoader {
-	const Chunk::DataBuffer*& bufptr;
-	RLoader(const Chunk::DataBuffer*& bufptr) : bufptr(bufptr) {}
+	ChunkView::MultidataIterator& bufptr;
+	RLoader(ChunkView::MultidataIterator& bufptr) : bufptr(bufptr) {}
 	template<typename T> void member(T& val, const char* name) { mdcReadTo(bufptr, val); }
 };
 
@@ -83,13 +83,14 @@ AudioObject* AudioManager::getObject(uint32_t id)
 	return nullptr;
 }
 
-void AudioManager::load(const Chunk& ands, const Chunk& sndr)
+void AudioManager::load(ChunkView ands, ChunkView sndr)
 {
 	auto loadType = [&](uint32_t tag, auto what) {
 		using T = typename decltype(what)::type;
-		const Chunk* chk = ands.findSubchunk(byteSwap32(tag));
-		assert(chk != nullptr);
-		const Chunk::DataBuffer* bufptr = chk->multidata.data();
+		ChunkView chk = ands.findSubchunk(byteSwap32(tag));
+		assert(chk);
+		ChunkView::MultidataIterator bufptr = chk.multidata().begin();
+		ChunkView::SubchunkIterator setsChunkIt = chk.subchunks().begin();
 		uint32_t mostlyOne, numObjects;
 		mdcReadTo(bufptr, mostlyOne);
 		mdcReadTo(bufptr, numObjects);
@@ -102,12 +103,22 @@ void AudioManager::load(const Chunk& ands, const Chunk& sndr)
 			obj->reflect(rl);
 			if constexpr (std::is_same_v<T, SetAudioObject>) {
 				SetAudioObject* set = (SetAudioObject*)obj.get();
-				const Chunk::DataBuffer* setsPtr = chk->subchunks[i].multidata.empty() ? &chk->subchunks[i].maindata : chk->subchunks[i].multidata.data();
-				uint32_t numEntries;
-				mdcReadTo(setsPtr, numEntries);
-				set->sounds.resize(numEntries);
-				for (auto& entry : set->sounds)
-					mdcReadTo(setsPtr, entry);
+				ChunkView setsChunk = *setsChunkIt;
+				++setsChunkIt;
+				if (setsChunk.hasMultidata()) {
+					ChunkView::MultidataIterator setsPtr = setsChunk.multidata().begin();
+					uint32_t numEntries;
+					mdcReadTo(setsPtr, numEntries);
+					set->sounds.resize(numEntries);
+					for (auto& entry : set->sounds)
+						mdcReadTo(setsPtr, entry);
+				}
+				else {
+					// empty set, only the entry count is stored as main data
+					uint32_t numEntries = *(const uint32_t*)setsChunk.maindata().data();
+					assert(numEntries == 0);
+					set->sounds.resize(numEntries);
+				}
 			}
 			allocateSlot(id);
 			audioObjects[id] = std::move(obj);
@@ -121,8 +132,8 @@ void AudioManager::load(const Chunk& ands, const Chunk& sndr)
 	loadType('MMPS', TypeIndicator<ImpactAudioObject>());
 	loadType('ROMS', TypeIndicator<RoomAudioObject>());
 
-	const Chunk::DataBuffer* sndrPtr = sndr.multidata.data();
-	for (size_t i = 0; i < sndr.multidata.size(); i += 2) {
+	ChunkView::MultidataIterator sndrPtr = sndr.multidata().begin();
+	for (size_t i = 0; i < sndr.numMultidata(); i += 2) {
 		uint32_t id;
 		std::string name;
 		mdcReadTo(sndrPtr, id);
@@ -35,7 +35,7 @@ struct AudioManager {
 		return nullptr;
 	}
 
-	void load(const Chunk& ands, const Chunk& sndr);
+	void load(ChunkView ands, ChunkView sndr);
 	std::pair<Chunk, Chunk> save() const;
 };
 
@@ -42,6 +42,7 @@ public:
 
 	Container take() { return std::move(buffer); }
 	Byte* getPointer(size_t addr = 0) { return buffer.data() + addr; }
+	const Byte* getPointer(size_t addr = 0) const { return buffer.data() + addr; }
 
 private:
 	Container buffer;
@@ -6,32 +6,113 @@
 #pragma once
 
 #include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+// Memory source for DynArray buffers
+class BufferAllocator {
+public:
+	virtual void* allocate(size_t size, size_t alignment) = 0;
+	virtual void deallocate(void* pointer, size_t size, size_t alignment) = 0;
+
+	// Allocator used by the DynArrays created on this thread, the heap by default
+	static BufferAllocator* current() { return currentAllocator ? currentAllocator : heap(); }
+	static BufferAllocator* heap();
+
+	// Makes new DynArrays on this thread use the given allocator, until the scope ends
+	class Scope {
+		BufferAllocator* previous;
+	public:
+		explicit Scope(BufferAllocator* allocator) : previous(currentAllocator) { currentAllocator = allocator; }
+		~Scope() { currentAllocator = previous; }
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	};
+
+protected:
+	~BufferAllocator() = default;
+
+private:
+	static inline thread_local BufferAllocator* currentAllocator = nullptr;
+};
+
+class HeapBufferAllocator : public BufferAllocator {
+public:
+	void* allocate(size_t size, size_t alignment) override { return ::operator new(size, std::align_val_t(alignment)); }
+	void deallocate(void* pointer, size_t, size_t alignment) override { ::operator delete(pointer, std::align_val_t(alignment)); }
+};
+
+inline BufferAllocator* BufferAllocator::heap()
+{
+	static HeapBufferAllocator heapAllocator;
+	return &heapAllocator;
+}
+
+// Standard allocator taking its memory from a BufferAllocator,
+// e.g. for std::allocate_shared with the scene's arena
+template <class T> struct BufferStdAllocator {
+	using value_type = T;
+	BufferAllocator* source;
+
+	explicit BufferStdAllocator(BufferAllocator* source) : source(source) {}
+	template <class U> BufferStdAllocator(const BufferStdAllocator<U>& other) : source(other.source) {}
+
+	T* allocate(size_t n) { return (T*)source->allocate(n * sizeof(T), alignof(T)); }
+	void deallocate(T* pointer, size_t n) { source->deallocate(pointer, n * sizeof(T), alignof(T)); }
+
+	template <class U> bool operator==(const BufferStdAllocator<U>& other) const { return source == other.source; }
+	template <class U> bool operator!=(const BufferStdAllocator<U>& other) const { return source != other.source; }
+};
+
+// Array of trivially copyable elements, with an uninitialized content when grown.
+// The storage comes from the allocator that was current when the array was created.
+template <class T, size_t Alignment = alignof(T)> class DynArray {
+	static_assert(std::is_trivially_copyable_v<T>, "DynArray copies its elements with memcpy.");
+	static_assert(Alignment >= alignof(T) && (Alignment & (Alignment - 1)) == 0, "Invalid alignment.");
 
-template <class T> class DynArray {
 private:
 	T* pointer;
 	size_t length;
+	size_t cap;
+	BufferAllocator* allocator;
 
 	void freeP() {
-		if (length)
-			delete[] pointer;
+		if (cap)
+			allocator->deallocate(pointer, cap * sizeof(T), Alignment);
 		pointer = nullptr;
 		length = 0;
+		cap = 0;
 	}
 
-	void setsize(size_t newlen) {
-		if (newlen)
-			pointer = new T[newlen];
-		length = newlen;
+	void setcap(size_t newcap) {
+		T* newpointer = (T*)allocator->allocate(newcap * sizeof(T), Alignment);
+		if (length)
+			memcpy(newpointer, pointer, length * sizeof(T));
+		size_t oldlength = length;
+		freeP();
+		pointer = newpointer;
+		length = oldlength;
+		cap = newcap;
 	}
 
 public:
+	// Keeps the current content, the new elements are uninitialized.
 	void resize(size_t newlen) {
-		freeP();
-		setsize(newlen);
+		if (newlen > cap)
+			setcap(newlen);
+		length = newlen;
 	}
 
+	void reserve(size_t newcap) {
+		if (newcap > cap)
+			setcap(newcap);
+	}
+
+	void clear() { length = 0; }
+
 	size_t size() const { return length; }
+	size_t capacity() const { return cap; }
 	T* data() { return pointer; }
 	const T* data() const { return pointer; }
 
@@ -43,11 +124,11 @@ public:
 	T& operator[] (size_t index) { return pointer[index]; }
 	const T& operator[] (size_t index) const { return pointer[index]; }
 
-	DynArray() { pointer = nullptr; length = 0; }
-	DynArray(int len) { setsize(len); }
-	DynArray(const DynArray &other) { setsize(other.length); memcpy(pointer, other.pointer, length * sizeof(T)); }
-	DynArray(DynArray &&other) noexcept { pointer = other.pointer; length = other.length; other.pointer = nullptr; other.length = 0; }
-	void operator=(const DynArray &other) { resize(other.length); memcpy(pointer, other.pointer, length * sizeof(T)); }
-	void operator=(DynArray &&other) noexcept { freeP(); pointer = other.pointer; length = other.length; other.pointer = nullptr; other.length = 0; }
+	DynArray() : pointer(nullptr), length(0), cap(0), allocator(BufferAllocator::current()) {}
+	DynArray(int len) : DynArray() { resize(len); }
+	DynArray(const DynArray &other) : DynArray() { resize(other.length); if (length) memcpy(pointer, other.pointer, length * sizeof(T)); }
+	DynArray(DynArray &&other) noexcept : pointer(other.pointer), length(other.length), cap(other.cap), allocator(other.allocator) { other.pointer = nullptr; other.length = 0; other.cap = 0; }
+	void operator=(const DynArray &other) { if (this == &other) return; length = 0; resize(other.length); if (length) memcpy(pointer, other.pointer, length * sizeof(T)); }
+	void operator=(DynArray &&other) noexcept { if (this == &other) return; freeP(); pointer = other.pointer; length = other.length; cap = other.cap; allocator = other.allocator; other.pointer = nullptr; other.length = 0; other.cap = 0; }
 	~DynArray() { freeP(); }
-};
\ No newline at end of file
+};
@@ -0,0 +1,78 @@
+// c47edit - Scene editor for HM C47
+// Copyright (C) 2018-2022 AdrienTD
+// Licensed under the GPL3+.
+// See LICENSE file for more details.
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "Span.h"
+
+// Array which can refer to elements in a shared buffer (such as the loaded SPK)
+// instead of owning a copy of them.
+// Reading through a const LazyArray accesses the shared buffer directly,
+// while any non-const access first copies the elements into an owned vector.
+template <class T> class LazyArray {
+private:
+	std::vector<T> owned;
+	const T* source = nullptr;
+	size_t sourceCount = 0;
+	std::shared_ptr<const void> sourceKeeper; // keeps the shared buffer alive
+
+public:
+	LazyArray() = default;
+	LazyArray(std::vector<T> vec) : owned(std::move(vec)) {}
+	LazyArray& operator=(std::vector<T> vec) { reset(); owned = std::move(vec); return *this; }
+
+	// Refer to count elements in the buffer owned by keeper, dropping the current content
+	void reference(std::shared_ptr<const void> keeper, const T* elements, size_t count) {
+		reset();
+		if (count == 0)
+			return;
+		source = elements;
+		sourceCount = count;
+		sourceKeeper = std::move(keeper);
+	}
+	bool isReference() const { return source != nullptr; }
+
+	// Read access, without copying
+	size_t size() const { return source ? sourceCount : owned.size(); }
+	bool empty() const { return size() == 0; }
+	const T* data() const { return source ? source : owned.data(); }
+	const T* begin() const { return data(); }
+	const T* end() const { return data() + size(); }
+	const T& operator[](size_t index) const { return data()[index]; }
+	Span<const T> view() const { return { data(), size() }; }
+
+	// Write access, copying the referenced elements first
+	std::vector<T>& edit() {
+		if (source) {
+			owned.assign(source, source + sourceCount);
+			source = nullptr;
+			sourceCount = 0;
+			sourceKeeper.reset();
+		}
+		return owned;
+	}
+	T* data() { return edit().data(); }
+	typename std::vector<T>::iterator begin() { return edit().begin(); }
+	typename std::vector<T>::iterator end() { return edit().end(); }
+	T& operator[](size_t index) { return edit()[index]; }
+	void resize(size_t count) { edit().resize(count); }
+	void reserve(size_t count) { edit().reserve(count); }
+	void push_back(const T& elem) { edit().push_back(elem); }
+	template <class... Args> T& emplace_back(Args&&... args) { return edit().emplace_back(std::forward<Args>(args)...); }
+	template <class... Args> auto insert(Args&&... args) { return edit().insert(std::forward<Args>(args)...); }
+	void clear() { reset(); }
+
+private:
+	void reset() {
+		owned.clear();
+		source = nullptr;
+		sourceCount = 0;
+		sourceKeeper.reset();
+	}
+};
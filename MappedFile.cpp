@@ -0,0 +1,59 @@
+// c47edit - Scene editor for HM C47
+// Copyright (C) 2018-2022 AdrienTD
+// Licensed under the GPL3+.
+// See LICENSE file for more details.
+
+#include "MappedFile.h"
+#include <map>
+#include <mutex>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+MappedFile::~MappedFile()
+{
+	if (view)
+		UnmapViewOfFile(view);
+	if (mappingHandle)
+		CloseHandle(mappingHandle);
+	if (fileHandle)
+		CloseHandle(fileHandle);
+}
+
+std::shared_ptr<const MappedFile> MappedFile::openCached(const std::string& path)
+{
+	static std::mutex cacheMutex;
+	// the mappings are released with their last user
+	static std::map<std::string, std::weak_ptr<const MappedFile>> cache;
+
+	// key by full path, since the working directory can change between scene loads
+	char fullPath[MAX_PATH];
+	DWORD fullLen = GetFullPathNameA(path.c_str(), MAX_PATH, fullPath, nullptr);
+	std::string key = (fullLen > 0 && fullLen < MAX_PATH) ? std::string(fullPath, fullLen) : path;
+
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	auto it = cache.find(key);
+	if (it != cache.end())
+		if (auto mapped = it->second.lock())
+			return mapped;
+
+	HANDLE file = CreateFileA(key.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+	std::shared_ptr<MappedFile> mapped(new MappedFile);
+	mapped->fileHandle = file;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+		return nullptr;
+	mapped->length = (size_t)fileSize.QuadPart;
+	if (mapped->length > 0) {
+		mapped->mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapped->mappingHandle)
+			return nullptr;
+		mapped->view = (const uint8_t*)MapViewOfFile(mapped->mappingHandle, FILE_MAP_READ, 0, 0, 0);
+		if (!mapped->view)
+			return nullptr;
+	}
+	cache[key] = mapped;
+	return mapped;
+}
@@ -0,0 +1,36 @@
+// c47edit - Scene editor for HM C47
+// Copyright (C) 2018-2022 AdrienTD
+// Licensed under the GPL3+.
+// See LICENSE file for more details.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	const uint8_t* data() const { return view; }
+	size_t size() const { return length; }
+
+	// Returns the mapping of the file at the given path, or nullptr if it can't be opened.
+	// The mapping is shared by every caller that opens the same file while it is still in use,
+	// and the file is closed once the last of them releases it.
+	// Files opened this way can't be modified while mapped (e.g. the game's Repeat.* files).
+	static std::shared_ptr<const MappedFile> openCached(const std::string& path);
+
+private:
+	MappedFile() = default;
+
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+	const uint8_t* view = nullptr;
+	size_t length = 0;
+};
@@ -0,0 +1,66 @@
+// c47edit - Scene editor for HM C47
+// Copyright (C) 2018-2022 AdrienTD
+// Licensed under the GPL3+.
+// See LICENSE file for more details.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <thread>
+#include <vector>
+
+// Calls func(i) for every i in [0, count), spread over all CPU cores.
+// The indices are given out in batches to the threads as they become free.
+// If func throws, the remaining indices are skipped and the first exception
+// is rethrown once every thread is done.
+template <class Func> void ParallelFor(size_t count, const Func& func, size_t batchSize = 64)
+{
+	size_t numBatches = (count + batchSize - 1) / batchSize;
+	size_t numThreads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), numBatches);
+	if (numThreads <= 1) {
+		for (size_t i = 0; i < count; ++i)
+			func(i);
+		return;
+	}
+
+	std::atomic<size_t> next = 0;
+	auto worker = [&]() {
+		try {
+			for (size_t first; (first = next.fetch_add(batchSize)) < count;) {
+				size_t last = std::min(first + batchSize, count);
+				for (size_t i = first; i < last; ++i)
+					func(i);
+			}
+		}
+		catch (...) {
+			next = count;
+			throw;
+		}
+	};
+
+	std::vector<std::future<void>> futures;
+	for (size_t t = 1; t < numThreads; ++t)
+		futures.push_back(std::async(std::launch::async, worker));
+	std::exception_ptr error;
+	try {
+		worker();
+	}
+	catch (...) {
+		error = std::current_exception();
+	}
+	for (auto& future : futures) {
+		try {
+			future.get();
+		}
+		catch (...) {
+			if (!error)
+				error = std::current_exception();
+		}
+	}
+	if (error)
+		std::rethrow_exception(error);
+}
@@ -0,0 +1,121 @@
+// c47edit - Scene editor for HM C47
+// Copyright (C) 2018-2022 AdrienTD
+// Licensed under the GPL3+.
+// See LICENSE file for more details.
+
+#include "RepeatIndex.h"
+#include "MappedFile.h"
+#include "chunk.h"
+#include <cstring>
+#include <map>
+#include <mutex>
+
+std::shared_ptr<RepeatIndex> RepeatIndex::forFile(const std::string& path)
+{
+	static std::mutex cacheMutex;
+	// an index keeps its file mapped, so an expired entry's file was released too
+	static std::map<const MappedFile*, std::weak_ptr<RepeatIndex>> cache;
+
+	auto file = MappedFile::openCached(path);
+	if (!file)
+		return nullptr;
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	auto& entry = cache[file.get()];
+	std::shared_ptr<RepeatIndex> index = entry.lock();
+	if (!index) {
+		index.reset(new RepeatIndex(std::move(file)));
+		entry = index;
+	}
+	return index;
+}
+
+const uint8_t* RepeatIndex::data() const
+{
+	return file->data();
+}
+
+void RepeatIndex::addPackRepeat(const void* packrep, uint32_t packrepsize)
+{
+	const uint32_t* words = (const uint32_t*)packrep;
+	uint32_t reconsoff = words[1];
+	const uint32_t* record = (const uint32_t*)((const uint8_t*)packrep + 8 + reconsoff);
+	const uint32_t* recordEnd = (const uint32_t*)((const uint8_t*)packrep + packrepsize);
+
+	std::unique_lock lock(mutex);
+	hasHeader = true;
+	headerValue = words[0];
+	for (; record + 4 <= recordEnd; record += 4) {
+		uint32_t repeatoff = record[0], size = record[2];
+		if (size >= 4 && (size_t)repeatoff + size <= file->size())
+			if (knownRegions.insert(((uint64_t)repeatoff << 32) | size).second)
+				pendingRegions.emplace_back(repeatoff, size);
+	}
+}
+
+uint64_t RepeatIndex::hashRegion(const uint8_t* data, uint32_t size) const
+{
+	// FNV-1a over the size and the content, except the first 4 bytes
+	// which the reconstruction records replace anyway
+	uint64_t hash = 0xCBF29CE484222325 ^ size;
+	for (uint32_t i = 4; i < size; ++i) {
+		hash ^= data[i];
+		hash *= 0x100000001B3;
+	}
+	return hash;
+}
+
+bool RepeatIndex::findRegion(const uint8_t* data, uint32_t size, uint32_t& outOffset) const
+{
+	auto [first, last] = regionsByHash.equal_range(hashRegion(data, size));
+	for (auto it = first; it != last; ++it) {
+		uint32_t offset = it->second;
+		const uint8_t* region = file->data() + offset;
+		if (!memcmp(region + 4, data + 4, size - 4)) {
+			outOffset = offset;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool RepeatIndex::makePackRepeat(const Chunk& pack, std::string& output)
+{
+	{
+		std::unique_lock lock(mutex);
+		if (!hasHeader)
+			return false;
+		for (auto& [offset, size] : pendingRegions)
+			regionsByHash.emplace(hashRegion(file->data() + offset, size), offset);
+		pendingRegions.clear();
+		pendingRegions.shrink_to_fit();
+	}
+
+	std::shared_lock lock(mutex);
+	std::string headers;
+	std::vector<uint32_t> records;
+	bool allFound = true;
+	pack.saveHeaders(
+		[&headers](const void* data, size_t length) {
+			headers.append((const char*)data, length);
+		},
+		[&](uint32_t offset, const Chunk::DataBuffer& data) {
+			uint32_t repeatoff;
+			if (!allFound)
+				return;
+			if (data.size() < 4 || !findRegion(data.data(), (uint32_t)data.size(), repeatoff)) {
+				allFound = false;
+				return;
+			}
+			records.insert(records.end(), { repeatoff, offset, (uint32_t)data.size(), *(const uint32_t*)data.data() });
+		});
+	if (!allFound)
+		return false;
+
+	output.clear();
+	output.reserve(8 + headers.size() + 4 * records.size());
+	uint32_t header[2] = { headerValue, (uint32_t)headers.size() };
+	output.append((const char*)header, 8);
+	output.append(headers);
+	output.append((const char*)records.data(), 4 * records.size());
+	return true;
+}
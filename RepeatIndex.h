@@ -0,0 +1,51 @@
+// c47edit - Scene editor for HM C47
+// Copyright (C) 2018-2022 AdrienTD
+// Licensed under the GPL3+.
+// See LICENSE file for more details.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct Chunk;
+class MappedFile;
+
+// Content index of the regions of a Repeat.* file that are referenced by loaded PackRepeat.* files,
+// so that saved packs can reference them again instead of containing a copy of their data.
+class RepeatIndex
+{
+public:
+	// Returns the index of the Repeat file at the given path, or nullptr if it can't be opened.
+	// Indices are shared by all scenes that use the same file, and are released
+	// (with the file's mapping) once the last of them is closed.
+	static std::shared_ptr<RepeatIndex> forFile(const std::string& path);
+
+	const uint8_t* data() const;
+
+	// Registers the regions referenced by a PackRepeat file's reconstruction records
+	void addPackRepeat(const void* packrep, uint32_t packrepsize);
+
+	// Builds a PackRepeat file for the pack, if every data of the pack is found in the Repeat file
+	// and a PackRepeat file was loaded before (for its header value).
+	bool makePackRepeat(const Chunk& pack, std::string& output);
+
+private:
+	explicit RepeatIndex(std::shared_ptr<const MappedFile> file) : file(std::move(file)) {}
+	uint64_t hashRegion(const uint8_t* data, uint32_t size) const;
+	bool findRegion(const uint8_t* data, uint32_t size, uint32_t& outOffset) const;
+
+	std::shared_ptr<const MappedFile> file;
+	mutable std::shared_mutex mutex;
+	bool hasHeader = false;
+	uint32_t headerValue = 0;
+	// Regions are only hashed when the index is first needed for saving
+	std::unordered_set<uint64_t> knownRegions; // offset << 32 | size
+	std::vector<std::pair<uint32_t, uint32_t>> pendingRegions; // offset, size
+	std::unordered_multimap<uint64_t, uint32_t> regionsByHash; // hash of size and content -> offset
+};
@@ -0,0 +1,107 @@
+// c47edit - Scene editor for HM C47
+// Copyright (C) 2018-2022 AdrienTD
+// Licensed under the GPL3+.
+// See LICENSE file for more details.
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Stores objects of the same type in big contiguous slabs.
+// Removed objects leave a free slot that is reused by the next creation,
+// and all remaining objects are destroyed together with the pool.
+template <class T, size_t SlabSize = 1024> class SlabPool {
+	struct Slot {
+		alignas(T) unsigned char storage[sizeof(T)];
+		T* object() { return std::launder((T*)storage); }
+	};
+
+	std::vector<std::unique_ptr<Slot[]>> slabs;
+	std::vector<std::pair<const Slot*, size_t>> slabsByAddress; // sorted, for indexOf
+	std::vector<bool> alive;          // per slot index
+	std::vector<uint32_t> freeSlots;
+
+	Slot& slot(size_t index) { return slabs[index / SlabSize][index % SlabSize]; }
+
+public:
+	SlabPool() = default;
+	SlabPool(SlabPool&&) = default;
+	SlabPool& operator=(SlabPool&& other) {
+		if (this != &other) {
+			clear();
+			slabs = std::move(other.slabs);
+			slabsByAddress = std::move(other.slabsByAddress);
+			alive = std::move(other.alive);
+			freeSlots = std::move(other.freeSlots);
+		}
+		return *this;
+	}
+	SlabPool(const SlabPool&) = delete;
+	SlabPool& operator=(const SlabPool&) = delete;
+	~SlabPool() { clear(); }
+
+	template <class... Args> T* create(Args&&... args) {
+		size_t index;
+		if (!freeSlots.empty()) {
+			index = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else {
+			index = alive.size();
+			if (index % SlabSize == 0) {
+				slabs.push_back(std::make_unique<Slot[]>(SlabSize));
+				std::pair<const Slot*, size_t> entry = { slabs.back().get(), slabs.size() - 1 };
+				slabsByAddress.insert(std::upper_bound(slabsByAddress.begin(), slabsByAddress.end(), entry), entry);
+			}
+			alive.push_back(false);
+		}
+		T* obj = new (slot(index).storage) T(std::forward<Args>(args)...);
+		alive[index] = true;
+		return obj;
+	}
+
+	void destroy(T* obj) {
+		size_t index = indexOf(obj);
+		assert(index < alive.size() && alive[index]);
+		obj->~T();
+		alive[index] = false;
+		freeSlots.push_back((uint32_t)index);
+	}
+
+	// Destroys every object in slot order, without walking any hierarchy
+	void clear() {
+		for (size_t i = 0; i < alive.size(); ++i)
+			if (alive[i])
+				slot(i).object()->~T();
+		slabs.clear();
+		slabsByAddress.clear();
+		alive.clear();
+		freeSlots.clear();
+	}
+
+	// Slot index of an object from this pool, or SIZE_MAX if it comes from elsewhere.
+	// The slot indices are dense, so they can index side arrays of slotCount() elements.
+	size_t indexOf(const T* obj) const {
+		const unsigned char* ptr = (const unsigned char*)obj;
+		auto it = std::upper_bound(slabsByAddress.begin(), slabsByAddress.end(), ptr,
+			[](const unsigned char* p, const std::pair<const Slot*, size_t>& slab) { return p < (const unsigned char*)slab.first; });
+		if (it == slabsByAddress.begin())
+			return SIZE_MAX;
+		const auto& [first, slabIndex] = *(it - 1);
+		if (ptr >= (const unsigned char*)(first + SlabSize))
+			return SIZE_MAX;
+		return slabIndex * SlabSize + ((const Slot*)ptr - first);
+	}
+	// Whether the slot holds an object, and not one that was destroyed
+	bool isAlive(size_t index) const { return index < alive.size() && alive[index]; }
+
+	size_t size() const { return alive.size() - freeSlots.size(); }
+	size_t slotCount() const { return alive.size(); }
+};
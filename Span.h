@@ -0,0 +1,33 @@
+// c47edit - Scene editor for HM C47
+// Copyright (C) 2018-2022 AdrienTD
+// Licensed under the GPL3+.
+// See LICENSE file for more details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Non-owning view over a contiguous range of elements (similar to C++20's std::span).
+// The viewed memory must outlive the span.
+template <class T> class Span {
+private:
+	T* pointer = nullptr;
+	size_t length = 0;
+
+public:
+	Span() = default;
+	Span(T* pointer, size_t length) : pointer(pointer), length(length) {}
+	template <class U> Span(const Span<U>& other) : pointer(other.data()), length(other.size()) {}
+
+	size_t size() const { return length; }
+	bool empty() const { return length == 0; }
+	T* data() const { return pointer; }
+
+	T* begin() const { return pointer; }
+	T* end() const { return pointer + length; }
+
+	T& operator[] (size_t index) const { return pointer[index]; }
+};
+
+using ByteSpan = Span<const uint8_t>;
@@ -4,147 +4,295 @@
 // See LICENSE file for more details.
 
 #include "chunk.h"
-#include <map>
+#include <algorithm>
 #include <cassert>
-#include "ByteWriter.h"
+#include <stdexcept>
 
 Chunk::~Chunk() = default;
 
+void SubchunkIndex::build(std::vector<Entry> newEntries)
+{
+	entries = std::move(newEntries);
+	std::sort(entries.begin(), entries.end());
+}
+
+Span<const SubchunkIndex::Entry> SubchunkIndex::findAll(uint32_t tag) const
+{
+	auto first = std::lower_bound(entries.begin(), entries.end(), Entry(tag, 0));
+	auto last = std::upper_bound(first, entries.end(), Entry(tag, UINT32_MAX));
+	return Span<const Entry>(entries.data() + (first - entries.begin()), last - first);
+}
+
 const Chunk *Chunk::findSubchunk(uint32_t tagkey) const
 {
-	for (const Chunk& sub : subchunks)
-		if (sub.tag == tagkey)
-			return &sub;
-	return nullptr;
+	// a few subchunks (like in EXC chunks) are quicker to scan than to index
+	static constexpr size_t minIndexedSubchunks = 8;
+	if (subchunks.size() < minIndexedSubchunks) {
+		for (const Chunk& sub : subchunks)
+			if (sub.tag == tagkey)
+				return &sub;
+		return nullptr;
+	}
+	auto found = subchunks.findAll(tagkey);
+	return found.empty() ? nullptr : &subchunks[found[0].second];
+}
+
+ChunkViewIndex::ChunkViewIndex(ChunkView view)
+{
+	subchunks.reserve(view.numSubchunks());
+	std::vector<SubchunkIndex::Entry> entries;
+	entries.reserve(view.numSubchunks());
+	for (ChunkView sub : view.subchunks()) {
+		entries.emplace_back(sub.tag(), (uint32_t)subchunks.size());
+		subchunks.push_back(sub);
+	}
+	index.build(std::move(entries));
 }
 
-void Chunk::load(void *bytes)
+ChunkView ChunkViewIndex::find(uint32_t tag) const
 {
-	Chunk *chk = this;
+	auto found = index.findAll(tag);
+	return found.empty() ? ChunkView() : subchunks[found[0].second];
+}
 
-	uint32_t* pnt = (uint32_t*)bytes;
+size_t ChunkView::headerSize() const
+{
+	size_t size = 8;
+	if (hasSubchunks() || hasMultidata())
+		size += 4;
+	if (hasSubchunks())
+		size += 4;
+	if (hasMultidata())
+		size += 4 + 4 * (size_t)numMultidata();
+	return size;
+}
 
-	chk->tag = *(pnt++);
-	uint32_t it = *(pnt++);
-	uint32_t chksize = it & 0x3FFFFFFF;
-	bool has_subchunks = it & 0x80000000;
-	bool has_multidata = it & 0x40000000;
+ChunkView::Range<ChunkView::SubchunkIterator> ChunkView::subchunks() const
+{
+	if (!bytes)
+		return {};
+	const uint8_t* first = bytes + headerSize();
+	return { { first, 0 }, { first, numSubchunks() } };
+}
 
-	uint32_t odat;
-	if(has_subchunks || has_multidata)
-		odat = *(pnt++);
-	else
-		odat = 8;
+ChunkView::Range<ChunkView::MultidataIterator> ChunkView::multidata() const
+{
+	if (!bytes || !hasMultidata())
+		return {};
+	const uint8_t* sizes = bytes + headerSize() - 4 * (size_t)numMultidata();
+	const uint8_t* data = bytes + dataOffset();
+	return { { sizes, data }, { sizes + 4 * (size_t)numMultidata(), nullptr } };
+}
 
-	uint32_t num_subchunks;
-	if(has_subchunks) num_subchunks = *(pnt++);
-	else num_subchunks = 0;
+ByteSpan ChunkView::multidata(size_t index) const
+{
+	auto it = multidata().begin();
+	for (size_t i = 0; i < index; ++i)
+		++it;
+	return *it;
+}
 
-	if(has_multidata)
-	{
-		uint32_t num_datas = *(pnt++);
-		chk->multidata.resize(num_datas);
-		for(auto& dat : chk->multidata)
-		{
-			uint32_t datlen = *(pnt++);
-			dat.resize(datlen);
-		}
-	}
-	else	chk->multidata.clear();
+ByteSpan ChunkView::maindata() const
+{
+	if (!bytes || hasMultidata())
+		return {};
+	uint32_t odat = dataOffset();
+	return ByteSpan(bytes + odat, size() - odat);
+}
+
+ChunkView ChunkView::findSubchunk(uint32_t tagkey) const
+{
+	for (ChunkView sub : subchunks())
+		if (sub.tag() == tagkey)
+			return sub;
+	return {};
+}
+
+void Chunk::load(const void *bytes)
+{
+	load(ChunkView(bytes));
+}
+
+void Chunk::load(ChunkView view)
+{
+	tag = view.tag();
 
 	// Subchunks
-	chk->subchunks.resize(num_subchunks);
-	for(auto& subchunk : subchunks)
-	{
-		subchunk.load(pnt);
-		uint32_t sublen = pnt[1] & 0x3FFFFFFF;
-		pnt = (uint32_t*)( (char*)pnt + sublen );
-	}
+	subchunks.resize(view.numSubchunks());
+	auto subIt = subchunks.begin();
+	for (ChunkView sub : view.subchunks())
+		(subIt++)->load(sub);
 
 	// Data / Multidata
-	char *dp = (char*)bytes + odat;
-	if(has_multidata)
+	multidata.resize(view.numMultidata());
+	if (view.hasMultidata())
 	{
-		for(auto& dat : multidata)
+		auto datIt = multidata.begin();
+		for (ByteSpan src : view.multidata())
 		{
-			memcpy(dat.data(), dp, dat.size());
-			dp += dat.size();
+			DataBuffer& dat = *(datIt++);
+			dat.resize(src.size());
+			memcpy(dat.data(), src.data(), src.size());
 		}
 		// clear maindata
 	}
 	else
 	{
-		uint32_t mainlen = chksize - odat;
-		maindata.resize(mainlen);
-		memcpy(maindata.data(), dp, maindata.size());
+		ByteSpan src = view.maindata();
+		maindata.resize(src.size());
+		memcpy(maindata.data(), src.data(), src.size());
 	}
 }
 
-static void WriteChunkToStringBuf(ByteWriter<std::string>& sb, Chunk *chk)
+static uint32_t ChunkHeaderSize(const Chunk& chk)
+{
+	bool hasmultidata = !chk.multidata.empty();
+	bool hassubchunks = !chk.subchunks.empty();
+	uint32_t size = 8;
+	if (hasmultidata || hassubchunks)
+		size += 4; // data offset
+	if (hassubchunks)
+		size += 4; // num subchunks
+	if (hasmultidata)
+		size += 4 + 4 * (uint32_t)chk.multidata.size(); // num datas + data lengths
+	return size;
+}
+
+static uint32_t ChunkDataSize(const Chunk& chk)
+{
+	if (chk.multidata.empty())
+		return (uint32_t)chk.maindata.size();
+	uint32_t size = 0;
+	for (auto& dat : chk.multidata)
+		size += (uint32_t)dat.size();
+	return size;
+}
+
+// First pass: compute the size of every chunk of the tree, in pre-order
+static uint32_t ComputeChunkSizes(const Chunk& chk, std::vector<uint32_t>& sizes)
 {
+	size_t index = sizes.size();
+	sizes.push_back(0);
+	uint32_t size = ChunkHeaderSize(chk);
+	for (auto& subchunk : chk.subchunks)
+		size += ComputeChunkSizes(subchunk, sizes);
+	size += ChunkDataSize(chk);
+	sizes[index] = size;
+	return size;
+}
+
+// Second pass: write the chunks with the sizes from the first pass.
+// If dataSink is given, the data is passed to it instead of being written after the headers.
+static void WriteChunk(const Chunk& chk, const uint32_t*& sizeIt, const Chunk::Sink& sink, const Chunk::DataSink* dataSink, uint32_t& offset)
+{
+	uint32_t size = *(sizeIt++);
+	bool hasmultidata = !chk.multidata.empty();
+	bool hassubchunks = !chk.subchunks.empty();
+
 	// Header
-	uint32_t begoff = (uint32_t)sb.size();
-	sb.addU32(chk->tag);
-	bool hasmultidata = !chk->multidata.empty();
-	bool hassubchunks = !chk->subchunks.empty();
-	sb.addS32(0); // reserved for size
+	uint32_t header[5];
+	int numHeaderWords = 0;
+	header[numHeaderWords++] = chk.tag;
+	header[numHeaderWords++] = size | (hasmultidata ? 0x40000000 : 0) | (hassubchunks ? 0x80000000 : 0);
 	if (hasmultidata || hassubchunks)
-		sb.addS32(0); // reserved for data offset
-	if (hassubchunks) {
-		uint32_t num_subchunks = (uint32_t)chk->subchunks.size();
-		sb.addU32(num_subchunks);
-	}
+		header[numHeaderWords++] = size - ChunkDataSize(chk); // data offset
+	if (hassubchunks)
+		header[numHeaderWords++] = (uint32_t)chk.subchunks.size();
 	if (hasmultidata)
-	{
-		uint32_t num_datas = (uint32_t)chk->multidata.size();
-		sb.addU32(num_datas);
-		for (auto& dat : chk->multidata) {
+		header[numHeaderWords++] = (uint32_t)chk.multidata.size();
+	sink(header, 4 * numHeaderWords);
+	offset += 4 * numHeaderWords;
+	if (hasmultidata) {
+		for (auto& dat : chk.multidata) {
 			uint32_t len = (uint32_t)dat.size();
-			sb.addU32(len);
+			sink(&len, 4);
 		}
+		offset += 4 * (uint32_t)chk.multidata.size();
 	}
 
 	// Subchunks
-	if (hassubchunks)
-		for (auto& subchunk : chk->subchunks)
-			WriteChunkToStringBuf(sb, &subchunk);
+	for (auto& subchunk : chk.subchunks)
+		WriteChunk(subchunk, sizeIt, sink, dataSink, offset);
 
 	// Data / Multidata
-	uint32_t odat = (uint32_t)sb.size() - begoff;
-	if (hasmultidata)
-		for (auto& dat : chk->multidata)
-			sb.addData(dat.data(), dat.size());
+	auto writeData = [&](const Chunk::DataBuffer& dat) {
+		if (!dat.size())
+			return;
+		if (dataSink)
+			(*dataSink)(offset, dat);
+		else
+			sink(dat.data(), dat.size());
+		offset += (uint32_t)dat.size();
+	};
+	if (hasmultidata) {
+		for (auto& dat : chk.multidata)
+			writeData(dat);
+	}
 	else
-		sb.addData(chk->maindata.data(), chk->maindata.size());
-	uint32_t endoff = (uint32_t)sb.size();
+		writeData(chk.maindata);
+}
 
-	// Write to the reserved values
-	uint8_t* headerPtr = (uint8_t*)sb.getPointer(begoff);
-	uint32_t lenflags = (endoff - begoff) | (hasmultidata ? 0x40000000 : 0) | (hassubchunks ? 0x80000000 : 0);
-	*(uint32_t*)(headerPtr + 4) = lenflags;
-	if (hasmultidata || hassubchunks)
-		*(uint32_t*)(headerPtr + 8) = odat;
+size_t Chunk::serializedSize() const
+{
+	size_t size = ChunkHeaderSize(*this) + ChunkDataSize(*this);
+	for (auto& subchunk : subchunks)
+		size += subchunk.serializedSize();
+	return size;
+}
+
+size_t Chunk::save(const Sink& sink) const
+{
+	std::vector<uint32_t> sizes;
+	uint32_t totalSize = ComputeChunkSizes(*this, sizes);
+	const uint32_t* sizeIt = sizes.data();
+	uint32_t offset = 0;
+	WriteChunk(*this, sizeIt, sink, nullptr, offset);
+	return totalSize;
 }
 
-std::string Chunk::saveToString()
+size_t Chunk::saveHeaders(const Sink& sink, const DataSink& dataSink) const
 {
-	ByteWriter<std::string> sb;
-	WriteChunkToStringBuf(sb, this);
-	return sb.take();
+	std::vector<uint32_t> sizes;
+	uint32_t totalSize = ComputeChunkSizes(*this, sizes);
+	const uint32_t* sizeIt = sizes.data();
+	uint32_t offset = 0;
+	WriteChunk(*this, sizeIt, sink, &dataSink, offset);
+	return totalSize;
 }
 
-Chunk Chunk::reconstructPackFromRepeat(void *packrep, uint32_t packrepsize, void *repeat)
+std::string Chunk::saveToString() const
+{
+	std::string str(serializedSize(), '\0');
+	char* out = str.data();
+	save([&out](const void* data, size_t length) {
+		memcpy(out, data, length);
+		out += length;
+	});
+	assert(out == str.data() + str.size());
+	return str;
+}
+
+Chunk Chunk::reconstructPackFromRepeat(const void *packrep, uint32_t packrepsize, const void *repeat)
 {
 	Chunk mainchk;
 
-	uint32_t *ppnt = (uint32_t*)packrep;
+	const uint32_t *ppnt = (const uint32_t*)packrep;
 	uint32_t reconsoff = *(ppnt + 1);
 	ppnt += 2;
 
+	// Flat table of data offsets (relative to the pack) to the buffers they are read into.
+	// Pointers to the buffers stay valid since every subchunk list is sized before recursing.
+	struct DataTarget {
+		uint32_t offset;
+		DataBuffer* buffer;
+		bool isMultidata;
+		bool operator<(const DataTarget& other) const { return offset < other.offset; }
+	};
+	std::vector<DataTarget> targets;
+
 	uint32_t currp = 0;
-	std::map<uint32_t, std::pair<Chunk*, int>> rpmap;
 
-	auto f = [&ppnt, &rpmap, &currp](Chunk *c, const auto& rec) -> void {
+	auto f = [&ppnt, &targets, &currp](Chunk *c, const auto& rec) -> void {
 		uint32_t beg = currp;
 		c->tag = *(ppnt++);
 		uint32_t info = *(ppnt++);
@@ -171,14 +319,16 @@ Chunk Chunk::reconstructPackFromRepeat(void *packrep, uint32_t packrepsize, void
 			}
 		}
 
+		// empty data is skipped, as it would share its offset with the next data
 		if (has_multidata) {
-			for (int md = 0; md < (int)num_multidata; ++md) {
-				rpmap[currp + datoff] = { c, md };
-				datoff += c->multidata[md].size();
+			for (auto& dat : c->multidata) {
+				if (dat.size())
+					targets.push_back({ currp + datoff, &dat, true });
+				datoff += (uint32_t)dat.size();
 			}
 		}
-		else {
-			rpmap[currp + datoff] = { c, -1 };
+		else if (csize > datoff) {
+			targets.push_back({ currp + datoff, &c->maindata, false });
 		}
 
 		if (has_subchunks) {
@@ -192,19 +342,32 @@ Chunk Chunk::reconstructPackFromRepeat(void *packrep, uint32_t packrepsize, void
 
 	f(&mainchk, f);
 
-	char* reconspnt = (char*)packrep + 8 + reconsoff;
-	ppnt = (uint32_t*)reconspnt;
+	// Parents' data come after their subchunks, so the table has to be sorted,
+	// but the records mostly follow the data order, which the cursor takes advantage of.
+	std::sort(targets.begin(), targets.end());
+	auto cursor = targets.begin();
+
+	const char* reconspnt = (const char*)packrep + 8 + reconsoff;
+	ppnt = (const uint32_t*)reconspnt;
 	uint32_t reconssize = packrepsize - (8 + reconsoff);
-	while ((char*)ppnt - reconspnt < reconssize)
+	while ((const char*)ppnt - reconspnt < reconssize)
 	{
 		uint32_t repeatoff = *(ppnt++);
-		Chunk* c; int multiDataIndex;
-		std::tie(c, multiDataIndex) = rpmap.at(*(ppnt++));
+		uint32_t dataoff = *(ppnt++);
 		uint32_t data_size = *(ppnt++);
-		DataBuffer& dataBuf = (multiDataIndex == -1) ? c->maindata : c->multidata[multiDataIndex];
-		assert(multiDataIndex == -1 || dataBuf.size() == data_size);
-		dataBuf.resize(data_size);
-		memcpy(dataBuf.data(), (char*)repeat + repeatoff, dataBuf.size());
+		if (cursor == targets.end() || cursor->offset != dataoff) {
+			cursor = std::lower_bound(targets.begin(), targets.end(), DataTarget{ dataoff, nullptr, false });
+			if (cursor == targets.end() || cursor->offset != dataoff)
+				throw std::out_of_range("PackRepeat record with unknown data offset");
+		}
+		DataTarget& target = *(cursor++);
+		DataBuffer& dataBuf = *target.buffer;
+		assert(!target.isMultidata || dataBuf.size() == data_size);
+		if (dataBuf.size() != data_size)
+			dataBuf.resize(data_size);
+		// The payloads can't simply point into the Repeat file,
+		// since their first 4 bytes are replaced by the record's value.
+		memcpy(dataBuf.data(), (const char*)repeat + repeatoff, dataBuf.size());
 		*(uint32_t*)dataBuf.data() = *(ppnt++);
 	}
 
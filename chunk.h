@@ -6,27 +6,201 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
 #include <string>
+#include <utility>
 #include <vector>
 #include "DynArray.h"
+#include "Span.h"
+
+// Sorted table of (tag, position) pairs, to find subchunks by tag
+// with a binary search instead of a linear scan.
+class SubchunkIndex
+{
+public:
+	using Entry = std::pair<uint32_t, uint32_t>; // tag, position in subchunk list
+
+	void build(std::vector<Entry> newEntries);
+	void clear() { entries.clear(); }
+	bool empty() const { return entries.empty(); }
+	// Entries with the given tag, ordered by position
+	Span<const Entry> findAll(uint32_t tag) const;
+
+private:
+	std::vector<Entry> entries;
+};
+
+// Read-only view of a chunk stored in a contiguous buffer (e.g. an extracted Pack file).
+// Contrary to Chunk, nothing is copied, the data is accessed in place,
+// so the buffer must outlive the view.
+struct ChunkView
+{
+	const uint8_t* bytes = nullptr;
+
+	ChunkView() = default;
+	explicit ChunkView(const void* bytes) : bytes((const uint8_t*)bytes) {}
+	explicit operator bool() const { return bytes != nullptr; }
+
+	uint32_t tag() const { return header(0); }
+	uint32_t size() const { return header(4) & 0x3FFFFFFF; }
+	bool hasSubchunks() const { return header(4) & 0x80000000; }
+	bool hasMultidata() const { return header(4) & 0x40000000; }
+	uint32_t dataOffset() const { return (hasSubchunks() || hasMultidata()) ? header(8) : 8; }
+	uint32_t numSubchunks() const { return hasSubchunks() ? header(12) : 0; }
+	uint32_t numMultidata() const { return hasMultidata() ? header(hasSubchunks() ? 16 : 12) : 0; }
+
+	struct SubchunkIterator {
+		const uint8_t* ptr; uint32_t index;
+		ChunkView operator*() const { return ChunkView(ptr); }
+		SubchunkIterator& operator++() { ptr += ChunkView(ptr).size(); ++index; return *this; }
+		bool operator!=(const SubchunkIterator& other) const { return index != other.index; }
+	};
+	struct MultidataIterator {
+		const uint8_t* sizePtr; const uint8_t* dataPtr;
+		ByteSpan operator*() const { return ByteSpan(dataPtr, *(const uint32_t*)sizePtr); }
+		MultidataIterator& operator++() { dataPtr += *(const uint32_t*)sizePtr; sizePtr += 4; return *this; }
+		bool operator!=(const MultidataIterator& other) const { return sizePtr != other.sizePtr; }
+	};
+	template <class It> struct Range {
+		It first, last;
+		It begin() const { return first; }
+		It end() const { return last; }
+	};
+
+	Range<SubchunkIterator> subchunks() const;
+	Range<MultidataIterator> multidata() const;
+	ByteSpan multidata(size_t index) const;
+	ByteSpan maindata() const;
+
+	ChunkView findSubchunk(uint32_t tag) const;
+
+private:
+	uint32_t header(size_t offset) const { return *(const uint32_t*)(bytes + offset); }
+	size_t headerSize() const;
+};
+
+// Tag index of a ChunkView's subchunks, built once and kept next to the view
+struct ChunkViewIndex
+{
+	std::vector<ChunkView> subchunks;
+	SubchunkIndex index;
+
+	explicit ChunkViewIndex(ChunkView view);
+	ChunkView find(uint32_t tag) const;
+	Span<const SubchunkIndex::Entry> findAll(uint32_t tag) const { return index.findAll(tag); }
+};
+
+// List of the subchunks of a Chunk, with the tag index used to look them up.
+// Like LazyArray, reading goes through the const functions, and any non-const access
+// counts as a change which makes the next lookup rebuild the index.
+// Changing a tag through a reference taken before a lookup is thus not detected,
+// take the reference again after the lookup.
+template <class T> class SubchunkList {
+private:
+	std::vector<T> chunks;
+	size_t generation = 1;
+	// Lazily built on first lookup, not copied along with the list.
+	// Not thread-safe: concurrent lookups on the same list must be synchronized.
+	mutable SubchunkIndex tagIndex;
+	mutable size_t indexGeneration = 0;
+
+public:
+	SubchunkList() = default;
+	SubchunkList(const SubchunkList& other) : chunks(other.chunks) {}
+	SubchunkList(SubchunkList&& other) noexcept : chunks(std::move(other.chunks)) { other.edit(); }
+	SubchunkList& operator=(const SubchunkList& other) { edit() = other.chunks; return *this; }
+	SubchunkList& operator=(SubchunkList&& other) noexcept { edit() = std::move(other.chunks); other.edit(); return *this; }
+
+	// Read access
+	size_t size() const { return chunks.size(); }
+	bool empty() const { return chunks.empty(); }
+	const T* data() const { return chunks.data(); }
+	typename std::vector<T>::const_iterator begin() const { return chunks.begin(); }
+	typename std::vector<T>::const_iterator end() const { return chunks.end(); }
+	const T& operator[](size_t index) const { return chunks[index]; }
+	const T& at(size_t index) const { return chunks.at(index); }
+	const T& back() const { return chunks.back(); }
+
+	// Entries with the given tag, ordered by position.
+	// Valid until the next lookup after a change.
+	Span<const SubchunkIndex::Entry> findAll(uint32_t tag) const {
+		if (indexGeneration != generation) {
+			std::vector<SubchunkIndex::Entry> entries(chunks.size());
+			for (size_t i = 0; i < chunks.size(); i++)
+				entries[i] = { chunks[i].tag, (uint32_t)i };
+			tagIndex.build(std::move(entries));
+			indexGeneration = generation;
+		}
+		return tagIndex.findAll(tag);
+	}
+
+	// Write access, invalidating the index
+	std::vector<T>& edit() { ++generation; return chunks; }
+	T* data() { return edit().data(); }
+	typename std::vector<T>::iterator begin() { return edit().begin(); }
+	typename std::vector<T>::iterator end() { return edit().end(); }
+	T& operator[](size_t index) { return edit()[index]; }
+	T& at(size_t index) { return edit().at(index); }
+	T& back() { return edit().back(); }
+	void resize(size_t count) { edit().resize(count); }
+	void reserve(size_t count) { chunks.reserve(count); }
+	void push_back(const T& elem) { edit().push_back(elem); }
+	template <class... Args> T& emplace_back(Args&&... args) { return edit().emplace_back(std::forward<Args>(args)...); }
+	template <class... Args> auto insert(Args&&... args) { return edit().insert(std::forward<Args>(args)...); }
+	template <class... Args> auto erase(Args&&... args) { return edit().erase(std::forward<Args>(args)...); }
+	void clear() { edit().clear(); }
+};
 
 struct Chunk
 {
-	using DataBuffer = DynArray<uint8_t>;
+	using DataBuffer = DynArray<uint8_t, 16>;
 
 	uint32_t tag = 0;
 	std::vector<DataBuffer> multidata;
-	std::vector<Chunk> subchunks;
+	SubchunkList<Chunk> subchunks;
 	DataBuffer maindata;
 
 	Chunk() = default;
 	Chunk(uint32_t tag) : tag(tag) {};
+	Chunk(const Chunk&) = default;
+	Chunk(Chunk&&) = default;
+	Chunk& operator=(const Chunk&) = default;
+	Chunk& operator=(Chunk&&) = default;
 	~Chunk();
 
+	// Looks the tag up in the index of the subchunks.
+	// The non-const versions count as a change of the subchunks, as the tags can be modified
+	// through the result, so use the const ones for repeated lookups in a large list.
 	const Chunk* findSubchunk(uint32_t tag) const;
-	Chunk* findSubchunk(uint32_t tag) { return (Chunk*)std::as_const(*this).findSubchunk(tag); }
+	Chunk* findSubchunk(uint32_t tag) { auto* found = (Chunk*)std::as_const(*this).findSubchunk(tag); subchunks.edit(); return found; }
+
+	template <class C> struct SubchunkRange {
+		struct Iterator {
+			C* chunk; const SubchunkIndex::Entry* entry;
+			C& operator*() const { return chunk->subchunks.data()[entry->second]; }
+			Iterator& operator++() { ++entry; return *this; }
+			bool operator!=(const Iterator& other) const { return entry != other.entry; }
+		};
+		C* chunk; Span<const SubchunkIndex::Entry> entries;
+		Iterator begin() const { return { chunk, entries.begin() }; }
+		Iterator end() const { return { chunk, entries.end() }; }
+		size_t size() const { return entries.size(); }
+	};
+	// Every subchunk with the given tag, ordered by position
+	SubchunkRange<const Chunk> findAllSubchunks(uint32_t tag) const { return { this, subchunks.findAll(tag) }; }
+	SubchunkRange<Chunk> findAllSubchunks(uint32_t tag) { auto found = subchunks.findAll(tag); subchunks.edit(); return { this, found }; }
+
+	// Receives the serialized chunk bytes in order
+	using Sink = std::function<void(const void* data, size_t length)>;
 
-	void load(void *bytes);
-	std::string saveToString();
-	static Chunk reconstructPackFromRepeat(void *packrep, uint32_t packrepsize, void *repeat);
+	void load(const void *bytes);
+	void load(ChunkView view);
+	size_t serializedSize() const;
+	size_t save(const Sink& sink) const;
+	// Receives a data buffer with its offset in the serialized chunk
+	using DataSink = std::function<void(uint32_t offset, const DataBuffer& data)>;
+	// Writes only the headers (like in PackRepeat files), the data is given to dataSink instead
+	size_t saveHeaders(const Sink& sink, const DataSink& dataSink) const;
+	std::string saveToString() const;
+	static Chunk reconstructPackFromRepeat(const void *packrep, uint32_t packrepsize, const void *repeat);
 };
@@ -9,6 +9,8 @@
 #include <charconv>
 #include <fstream>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <nlohmann/json.hpp>
 
@@ -160,11 +162,23 @@ void ClassInfo::AddDBLMemberInfo(std::vector<ClassInfo::ObjectMember>& members,
 	members.emplace_back(&emptyMember);
 }
 
-// Return a list of names of all DBL members of the object
-std::vector<ClassInfo::ObjectMember> ClassInfo::GetMemberNames(GameObject* obj)
+// Member lists of the objects, by class ID and component list.
+// Editing Routs adds a new list for every intermediate string, so the cache is cleared when it grows too big.
+static constexpr size_t maxCachedCpntLists = 1024;
+static std::unordered_set<std::string> g_internedCpntLists; // keys of the inner maps
+static std::unordered_map<int, std::unordered_map<std::string_view, ClassInfo::MemberLayout>> g_objectMemberLayouts;
+// Member lists of member list strings, owning the ClassMembers they refer to
+struct ListMemberLayout {
+	std::vector<ClassInfo::ClassMember> classMembers;
+	std::vector<ClassInfo::ObjectMember> members;
+};
+static std::unordered_map<std::string, ClassInfo::MemberLayout> g_listMemberLayouts;
+
+// Build the list of DBL members of an object of the given class and component list
+static std::vector<ClassInfo::ObjectMember> BuildMemberNames(int typeId, const std::string& cpntList)
 {
-	static const ClassMember emptyMember = { "", "" };
-	static const ClassMember initialMembers[3] = { {"CHAR*", "Routs"}, {"ENUM", "Create", "", {"ROOT", "CLIP"}}, {"SCRIPT", "ZGeomScript"}}; // some objects might have less or more initial members...
+	static const ClassInfo::ClassMember emptyMember = { "", "" };
+	static const ClassInfo::ClassMember initialMembers[3] = { {"CHAR*", "Routs"}, {"ENUM", "Create", "", {"ROOT", "CLIP"}}, {"SCRIPT", "ZGeomScript"}}; // some objects might have less or more initial members...
 	std::vector<ClassInfo::ObjectMember> members = { {&initialMembers[0]}, {&initialMembers[1]}, {&initialMembers[2]}, {&emptyMember} };
 	auto onClass = [&members](const auto& rec, const nlohmann::json& cl) -> void {
 		if (cl.at("name") == "ZGEOM")
@@ -173,28 +187,63 @@ std::vector<ClassInfo::ObjectMember> ClassInfo::GetMemberNames(GameObject* obj)
 		rec(rec, *g_classInfo_idJsonMap.at(g_classInfo_stringIdMap.at(parent))); // recursive call to parent class
 		const auto& membersString = cl.at("members").get_ref<const std::string&>();
 		const auto& memlist = g_classMemberLists.at(cl.at("name").get_ref<const std::string&>());
-		AddDBLMemberInfo(members, memlist);
+		ClassInfo::AddDBLMemberInfo(members, memlist);
 	};
-	onClass(onClass, *g_classInfo_idJsonMap.at(obj->type));
+	onClass(onClass, *g_classInfo_idJsonMap.at(typeId));
 
-	if (!obj->dbl.entries.empty()) {
-		const auto& cpntList = std::get<std::string>(obj->dbl.entries[0].value);
-		const char* ptr = cpntList.c_str(), *beg;
-		auto skipWhitespace = [&ptr]() {while (*ptr && *ptr == ' ') ++ptr; };
-		auto skipWord = [&ptr]() {while (*ptr && *ptr != ' ' && *ptr != ',') ++ptr; };
-		auto nextElem = [&ptr]() {while (*ptr && *ptr != ',') ++ptr; if (*ptr) ++ptr; };
-		while (*ptr) {
-			skipWhitespace();
-			beg = ptr;
-			skipWord();
-			auto cpntName = std::string_view(beg, (size_t)(ptr - beg));
-			nextElem();
-			skipWhitespace();
+	const char* ptr = cpntList.c_str(), *beg;
+	auto skipWhitespace = [&ptr]() {while (*ptr && *ptr == ' ') ++ptr; };
+	auto skipWord = [&ptr]() {while (*ptr && *ptr != ' ' && *ptr != ',') ++ptr; };
+	auto nextElem = [&ptr]() {while (*ptr && *ptr != ',') ++ptr; if (*ptr) ++ptr; };
+	while (*ptr) {
+		skipWhitespace();
+		beg = ptr;
+		skipWord();
+		auto cpntName = std::string_view(beg, (size_t)(ptr - beg));
+		nextElem();
+		skipWhitespace();
 
-			const auto& memlist = g_classMemberLists.at(std::string(cpntName));
-			AddDBLMemberInfo(members, memlist);
-		}
+		const auto& memlist = g_classMemberLists.at(std::string(cpntName));
+		ClassInfo::AddDBLMemberInfo(members, memlist);
 	}
 
 	return members;
 }
+
+// Return a list of names of all DBL members of the object
+ClassInfo::MemberLayout ClassInfo::GetMemberNames(GameObject* obj)
+{
+	std::string_view cpntList = obj->dbl.entries.empty() ? std::string_view() : obj->dbl.getString(obj->dbl.entries[0]);
+	auto& classLayouts = g_objectMemberLayouts[obj->type];
+	auto it = classLayouts.find(cpntList);
+	if (it != classLayouts.end())
+		return it->second;
+	// the string is only interned once the list is built, as unknown components throw
+	std::string cpntListStr(cpntList);
+	MemberLayout layout = std::make_shared<const std::vector<ObjectMember>>(BuildMemberNames(obj->type, cpntListStr));
+	if (g_internedCpntLists.size() >= maxCachedCpntLists)
+		ClearMemberNamesCache();
+	const std::string& interned = *g_internedCpntLists.insert(std::move(cpntListStr)).first;
+	g_objectMemberLayouts[obj->type].emplace(interned, layout);
+	return layout;
+}
+
+ClassInfo::MemberLayout ClassInfo::GetListMemberNames(const std::string& membersString)
+{
+	auto it = g_listMemberLayouts.find(membersString);
+	if (it != g_listMemberLayouts.end())
+		return it->second;
+	auto list = std::make_shared<ListMemberLayout>();
+	list->classMembers = ProcessClassMemberListString(membersString);
+	AddDBLMemberInfo(list->members, list->classMembers);
+	MemberLayout layout(list, &list->members);
+	g_listMemberLayouts.emplace(membersString, layout);
+	return layout;
+}
+
+void ClassInfo::ClearMemberNamesCache()
+{
+	g_objectMemberLayouts.clear();
+	g_internedCpntLists.clear();
+	g_listMemberLayouts.clear();
+}
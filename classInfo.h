@@ -6,6 +6,7 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -45,8 +46,20 @@ namespace ClassInfo {
 	// Get an array of members for the DBL (arrays repeat the same member in the list)
 	void AddDBLMemberInfo(std::vector<ObjectMember>& members, const std::vector<ClassMember>& memlist);
 
-	// Return a list of names of all DBL members of the object
-	std::vector<ObjectMember> GetMemberNames(GameObject* obj);
+	// Shared and immutable list of DBL members
+	using MemberLayout = std::shared_ptr<const std::vector<ObjectMember>>;
+
+	// Return a list of names of all DBL members of the object.
+	// The lists are cached by class and component list (Routs), so editing Routs gives another list.
+	// Not thread-safe.
+	MemberLayout GetMemberNames(GameObject* obj);
+
+	// Return the DBL members of a member list string (such as the ZDefines types), cached by string.
+	// Not thread-safe.
+	MemberLayout GetListMemberNames(const std::string& membersString);
+
+	// Forget the cached member lists (the lists already returned stay valid)
+	void ClearMemberNamesCache();
 }
 
 extern std::map<std::string, std::vector<ClassInfo::ClassMember>> g_classMemberLists;
@@ -4,6 +4,7 @@
 
 #include "debug.h"
 
+#include <chrono>
 #include <vector>
 
 #define WIN32_LEAN_AND_MEAN
@@ -54,6 +55,32 @@ struct DataCoverage {
 	}
 };
 
+// Builds a PackRepeat/Repeat pair shaped like a texture pack (one root with many data chunks)
+static void MakeSyntheticPackRepeat(uint32_t numChunks, std::vector<uint8_t>& packRepeat, std::vector<uint8_t>& repeat)
+{
+	std::vector<uint32_t> headers, records;
+	uint32_t rootSize = 16;
+	for (uint32_t i = 0; i < numChunks; ++i)
+		rootSize += 8 + 16 + (i * 37) % 4000;
+	headers.insert(headers.end(), { 'DXT', rootSize | 0x80000000, rootSize, numChunks });
+	uint32_t offset = 16;
+	repeat.clear();
+	for (uint32_t i = 0; i < numChunks; ++i) {
+		uint32_t dataSize = 16 + (i * 37) % 4000;
+		headers.insert(headers.end(), { i, 8 + dataSize });
+		uint32_t repeatOffset = (uint32_t)repeat.size();
+		repeat.resize(repeat.size() + dataSize, (uint8_t)i);
+		records.insert(records.end(), { repeatOffset, offset + 8, dataSize, i });
+		offset += 8 + dataSize;
+	}
+	packRepeat.resize(8 + 4 * (headers.size() + records.size()));
+	uint32_t* out = (uint32_t*)packRepeat.data();
+	*(out++) = 0;
+	*(out++) = 4 * (uint32_t)headers.size();
+	memcpy(out, headers.data(), 4 * headers.size());
+	memcpy(out + headers.size(), records.data(), 4 * records.size());
+}
+
 void EnableVT100()
 {
 	static bool enabled = false;
@@ -134,13 +161,47 @@ void IGDebugMenus()
 			walkObj(g_scene.superroot, walkObj);
 
 		}
+		if (ImGui::MenuItem("Benchmark PackRepeat reconstruction")) {
+			std::vector<uint8_t> packRepeat, repeat;
+			MakeSyntheticPackRepeat(50000, packRepeat, repeat);
+			constexpr int numRuns = 5;
+			auto start = std::chrono::steady_clock::now();
+			for (int run = 0; run < numRuns; ++run) {
+				Chunk pack = Chunk::reconstructPackFromRepeat(packRepeat.data(), (uint32_t)packRepeat.size(), repeat.data());
+				assert(pack.subchunks.size() == 50000);
+			}
+			auto end = std::chrono::steady_clock::now();
+			printf("PackRepeat reconstruction: %.2f ms per run (%zu records, %zu bytes of payloads)\n",
+				std::chrono::duration<double, std::milli>(end - start).count() / numRuns, (size_t)50000, repeat.size());
+		}
+		if (ImGui::MenuItem("Compare serial and parallel SPK construction")) {
+			// both runs encode every DBL and EXC, instead of reusing the previous encoding
+			auto invalidateAll = [](GameObject* obj, auto& rec) -> void {
+				obj->invalidateSaveCache();
+				for (auto* child : obj->subobj)
+					rec(child, rec);
+			};
+			invalidateAll(g_scene.superroot, invalidateAll);
+			auto start = std::chrono::steady_clock::now();
+			Chunk serial = g_scene.ConstructSPK(false);
+			auto middle = std::chrono::steady_clock::now();
+			invalidateAll(g_scene.superroot, invalidateAll);
+			auto beforeParallel = std::chrono::steady_clock::now();
+			Chunk parallel = g_scene.ConstructSPK(true);
+			auto end = std::chrono::steady_clock::now();
+			bool same = serial.saveToString() == parallel.saveToString();
+			printf("SPK construction: serial %.2f ms, parallel %.2f ms, %s\n",
+				std::chrono::duration<double, std::milli>(middle - start).count(),
+				std::chrono::duration<double, std::milli>(end - beforeParallel).count(),
+				same ? "identical" : "\x1B[91mDIFFERENT!\x1B[0m");
+		}
 		if (ImGui::MenuItem("List Components")) {
 			auto walkObj = [](GameObject* obj, auto& rec) -> void {
 				if (!obj->dbl.entries.empty()) {
-					const std::string& str = std::get<std::string>(obj->dbl.entries[0].value);
+					std::string_view str = obj->dbl.getString(obj->dbl.entries[0]);
 					if (!str.empty()) {
 						printf("%s\n", obj->getPath().c_str());
-						printf("  %s\n", str.c_str());
+						printf("  %.*s\n", (int)str.size(), str.data());
 					}
 				}
 				for (auto* child : obj->subobj) {
@@ -4,6 +4,8 @@
 // See LICENSE file for more details.
 
 #include <functional>
+#include <future>
+#include <thread>
 #include <array>
 #include <map>
 #include <unordered_map>
@@ -14,6 +16,8 @@
 #include "vecmat.h"
 #include "ByteWriter.h"
 #include "classInfo.h"
+#include "RepeatIndex.h"
+#include "Parallel.h"
 
 #include <miniz/miniz.h>
 
@@ -71,74 +75,139 @@ const char *GetObjTypeString(uint32_t ot)
 	return otname;
 }
 
-uint32_t ComputeBytesum(void* data, size_t length) {
+uint32_t ComputeBytesum(const void* data, size_t length) {
 	uint32_t sum = 0;
-	uint8_t* bytes = (uint8_t*)data;
+	const uint8_t* bytes = (const uint8_t*)data;
 	for (size_t i = 0; i < length; ++i)
 		sum += bytes[i];
 	return sum;
 }
 
-static void ReadAssetPacks(Scene* scene, mz_zip_archive* zip)
+// Inflates and parses the PackRepeat.<ext> or Pack.<ext> file from a scene ZIP in memory.
+// Returns an error message, empty if successful.
+// The index of the Repeat file used is given to outRepeat.
+static std::string ReadPackFromZip(const std::vector<uint8_t>& zipmem, BufferAllocator* allocator, const char* ext, Chunk* pack, bool* outFound,
+	std::shared_ptr<RepeatIndex>* outRepeat)
 {
-	static const auto readFile = [](const char* filename) {
-		void* repmem; size_t repsize;
-		FILE* repfile = fopen(filename, "rb");
-		if (!repfile) ferr("Could not open Repeat.* file.\nBe sure you copied all the 4 files named \"Repeat\" (with .ANM, .DXT, .PAL, .WAV extensions) from the Hitman C47 game's folder into the editor's folder (where c47edit.exe is).");
-		fseek(repfile, 0, SEEK_END);
-		repsize = ftell(repfile);
-		fseek(repfile, 0, SEEK_SET);
-		repmem = malloc(repsize);
-		fread(repmem, repsize, 1, repfile);
-		fclose(repfile);
-		return std::make_pair(repmem, repsize);
-	};
-
-	const auto readPack = [&zip](const char* ext, Chunk& pack, bool* outFound = nullptr) {
-		std::string fnPackRepeat = std::string("PackRepeat.") + ext;
-		std::string fnRepeat = std::string("Repeat.") + ext;
-		std::string fnPack = std::string("Pack.") + ext;
-		void* packmem; size_t packsize;
-		packmem = mz_zip_reader_extract_file_to_heap(zip, fnPackRepeat.c_str(), &packsize, 0);
-		if (packmem)
-		{
-			auto [repmem, repsize] = readFile(fnRepeat.c_str());
-			pack = Chunk::reconstructPackFromRepeat(packmem, packsize, repmem);
-			free(repmem);
+	BufferAllocator::Scope allocatorScope(allocator);
+	mz_zip_archive zip;
+	mz_zip_zero_struct(&zip);
+	if (!mz_zip_reader_init_mem(&zip, zipmem.data(), zipmem.size(), 0)) return "Failed to initialize ZIP reading.";
+	std::string fnPackRepeat = std::string("PackRepeat.") + ext;
+	std::string fnRepeat = std::string("Repeat.") + ext;
+	std::string fnPack = std::string("Pack.") + ext;
+	std::string error;
+	void* packmem; size_t packsize;
+	packmem = mz_zip_reader_extract_file_to_heap(&zip, fnPackRepeat.c_str(), &packsize, 0);
+	if (packmem)
+	{
+		// Repeat.* files are mapped once and shared by all loaded scenes
+		std::shared_ptr<RepeatIndex> repeat = RepeatIndex::forFile(fnRepeat);
+		if (repeat) {
+			*pack = Chunk::reconstructPackFromRepeat(packmem, packsize, repeat->data());
+			repeat->addPackRepeat(packmem, (uint32_t)packsize);
+			*outRepeat = std::move(repeat);
 		}
 		else
-		{
-			packmem = mz_zip_reader_extract_file_to_heap(zip, fnPack.c_str(), &packsize, 0);
-			if (!packmem && !outFound) ferr("Failed to find Pack.* or PackRepeat.* in ZIP archive.");
-			if (packmem)
-				pack.load(packmem);
-		}
-		if (outFound)
-			*outFound = packmem;
-		if (packmem)
-			free(packmem);
+			error = "Could not open Repeat.* file.\nBe sure you copied all the 4 files named \"Repeat\" (with .ANM, .DXT, .PAL, .WAV extensions) from the Hitman C47 game's folder into the editor's folder (where c47edit.exe is).";
+	}
+	else
+	{
+		packmem = mz_zip_reader_extract_file_to_heap(&zip, fnPack.c_str(), &packsize, 0);
+		if (!packmem && !outFound) error = "Failed to find Pack.* or PackRepeat.* in ZIP archive.";
+		if (packmem) {
+			// the root tag is the multicharacter constant of the extension, like 'PAL'
+			uint32_t expectedTag = ((uint8_t)ext[0] << 16) | ((uint8_t)ext[1] << 8) | (uint8_t)ext[2];
+			ChunkView view(packmem);
+			if (view.tag() != expectedTag)
+				error = "Unexpected root chunk in Pack.* file.";
+			else
+				pack->load(view);
+		}
+	}
+	if (outFound)
+		*outFound = packmem;
+	if (packmem)
+		free(packmem);
+	mz_zip_reader_end(&zip);
+	return error;
+}
+
+// Inflates and parses Pack.SPK and the PAL, DXT and LGT packs concurrently.
+// Every worker has its own ZIP reader over the scene's zipmem.
+// Errors are only reported once all workers have finished.
+// The WAV pack is left compressed until first accessed, the ANM pack is never parsed.
+static void ReadScenePacks(Scene* scene)
+{
+	const auto openZip = [scene](mz_zip_archive& zip) {
+		mz_zip_zero_struct(&zip);
+		return mz_zip_reader_init_mem(&zip, scene->zipmem.data(), scene->zipmem.size(), 0);
 	};
 
-	readPack("PAL", scene->palPack);
-	readPack("DXT", scene->dxtPack);
-	readPack("LGT", scene->lgtPack);
-	readPack("WAV", scene->wavPack);
-	readPack("ANM", scene->anmPack, &scene->hasAnmPack);
+	const std::vector<uint8_t>& zipmem = scene->zipmem;
+	std::future<std::string> packReaders[] = {
+		std::async(std::launch::async, ReadPackFromZip, std::cref(zipmem), scene->bufferArena.get(), "PAL", &scene->palPack, nullptr, &scene->repeatIndices.pal),
+		std::async(std::launch::async, ReadPackFromZip, std::cref(zipmem), scene->bufferArena.get(), "DXT", &scene->dxtPack, nullptr, &scene->repeatIndices.dxt),
+		std::async(std::launch::async, ReadPackFromZip, std::cref(zipmem), scene->bufferArena.get(), "LGT", &scene->lgtPack, nullptr, &scene->repeatIndices.lgt),
+	};
 
-	if (scene->palPack.tag != 'PAL') ferr("Not a PAL chunk in Repeat.PAL");
-	if (scene->dxtPack.tag != 'DXT') ferr("Not a DXT chunk in Repeat.DXT");
-	if (scene->lgtPack.tag != 'LGT') ferr("Not a LGT chunk in Repeat.LGT");
+	// Pack.SPK is extracted on this thread meanwhile
+	std::string error;
+	mz_zip_archive zip;
+	if (openZip(zip)) {
+		mz_zip_archive_file_stat spkstat;
+		int spkindex = mz_zip_reader_locate_file(&zip, "Pack.SPK", nullptr, 0);
+		if (spkindex == -1 || !mz_zip_reader_file_stat(&zip, spkindex, &spkstat))
+			error = "Failed to find Pack.SPK in ZIP archive.";
+		else {
+			auto spkData = std::make_shared<std::vector<uint8_t>>((size_t)spkstat.m_uncomp_size);
+			if (!mz_zip_reader_extract_to_mem(&zip, spkindex, spkData->data(), spkData->size(), 0))
+				error = "Failed to extract Pack.SPK from ZIP archive.";
+			scene->spkData = std::move(spkData);
+		}
+		if (error.empty() && mz_zip_reader_locate_file(&zip, "PackRepeat.WAV", nullptr, 0) == -1 && mz_zip_reader_locate_file(&zip, "Pack.WAV", nullptr, 0) == -1)
+			error = "Failed to find Pack.* or PackRepeat.* in ZIP archive.";
+		scene->hasAnmPack = mz_zip_reader_locate_file(&zip, "PackRepeat.ANM", nullptr, 0) != -1 || mz_zip_reader_locate_file(&zip, "Pack.ANM", nullptr, 0) != -1;
+		scene->wavPackLoaded = false;
+		mz_zip_reader_end(&zip);
+	}
+	else
+		error = "Failed to initialize ZIP reading.";
+
+	for (auto& reader : packReaders) {
+		std::string packError = reader.get();
+		if (error.empty())
+			error = std::move(packError);
+	}
+	if (!error.empty())
+		throw c47editException(error);
+
+	if (scene->palPack.tag != 'PAL') throw c47editException("Not a PAL chunk in Repeat.PAL");
+	if (scene->dxtPack.tag != 'DXT') throw c47editException("Not a DXT chunk in Repeat.DXT");
+	if (scene->lgtPack.tag != 'LGT') throw c47editException("Not a LGT chunk in Repeat.LGT");
 	assert(scene->palPack.subchunks.size() == scene->dxtPack.subchunks.size());
 }
 
+Chunk& Scene::getWavPack()
+{
+	if (!wavPackLoaded) {
+		std::string error = ReadPackFromZip(zipmem, bufferArena.get(), "WAV", &wavPack, nullptr, &repeatIndices.wav);
+		if (!error.empty())
+			throw c47editException(error);
+		wavPackLoaded = true;
+	}
+	return wavPack;
+}
+
 void Scene::LoadEmpty()
 {
 	Close();
+	bufferArena = std::make_unique<Arena>();
 
 	// Duplicated :(
-	rootobj = new GameObject("Root", 0x21 /*ZROOM*/);
-	cliprootobj = new GameObject("ClipRoot", 0x21 /*ZROOM*/);
-	superroot = new GameObject("SuperRoot", 0x21);
+	rootobj = newObject("Root", 0x21 /*ZROOM*/);
+	cliprootobj = newObject("ClipRoot", 0x21 /*ZROOM*/);
+	superroot = newObject("SuperRoot", 0x21);
 	superroot->subobj.push_back(rootobj);
 	superroot->subobj.push_back(cliprootobj);
 	rootobj->parent = cliprootobj->parent = superroot;
@@ -153,7 +222,7 @@ void Scene::LoadEmpty()
 
 	dlcFiles = { "GeomsBase.dlc", "EventsBase.dlc" };
 	scenePaths = { "Worlds", "Masters", "Z:\\c47edit", "Sounds", "" };
-	zdefValues.entries.emplace_back().type = DBLEntry::EType::TERMINATOR;
+	zdefValues.addEntry(DBLEntry::EType::TERMINATOR);
 
 	audioMgr.audioNames.resize(1);
 	audioMgr.audioObjects.resize(1);
@@ -161,12 +230,160 @@ void Scene::LoadEmpty()
 	ready = true;
 }
 
+// Content hash of a mesh's geometry
+static uint64_t HashMeshContent(const Mesh& mesh)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+	auto add = [&hash](const auto& vec) {
+		const uint8_t* bytes = (const uint8_t*)vec.data();
+		size_t size = vec.size() * sizeof(vec[0]);
+		hash = (hash ^ size) * 0x100000001b3;
+		for (size_t i = 0; i < size; ++i)
+			hash = (hash ^ bytes[i]) * 0x100000001b3;
+	};
+	hash = (hash ^ mesh.weird) * 0x100000001b3;
+	add(mesh.vertices);
+	add(mesh.quadindices);
+	add(mesh.triindices);
+	add(mesh.ftxFaces);
+	add(mesh.textureCoords);
+	add(mesh.lightCoords);
+	return hash;
+}
+
+static bool SameMeshContent(const Mesh& a, const Mesh& b)
+{
+	auto same = [](const auto& va, const auto& vb) {
+		return va.size() == vb.size() && (va.empty() || !memcmp(va.data(), vb.data(), va.size() * sizeof(va[0])));
+	};
+	return a.weird == b.weird && same(a.vertices, b.vertices) && same(a.quadindices, b.quadindices)
+		&& same(a.triindices, b.triindices) && same(a.ftxFaces, b.ftxFaces)
+		&& same(a.textureCoords, b.textureCoords) && same(a.lightCoords, b.lightCoords);
+}
+
+// Makes the objects whose meshes have byte-identical geometry share a single Mesh,
+// even if the meshes were stored separately in the SPK.
+// Meshes with an extension or used by an object with an EXC chunk (skinning) are left alone,
+// since they need more than the geometry to be rendered/saved the same.
+static void MergeIdenticalMeshes(const std::vector<GameObject*>& objects)
+{
+	std::vector<std::shared_ptr<Mesh>> meshes;
+	std::unordered_map<Mesh*, size_t> meshIndices;
+	std::vector<bool> excluded;
+	for (GameObject* o : objects) {
+		if (!o || !o->mesh)
+			continue;
+		auto [it, isNew] = meshIndices.try_emplace(o->mesh.get(), meshes.size());
+		if (isNew) {
+			meshes.push_back(o->mesh);
+			excluded.push_back(o->mesh->extension != nullptr);
+		}
+		if (o->excChunk)
+			excluded[it->second] = true;
+	}
+
+	std::vector<uint64_t> hashes(meshes.size());
+	ParallelFor(meshes.size(), [&](size_t i) {
+		if (!excluded[i])
+			hashes[i] = HashMeshContent(*meshes[i]);
+	});
+
+	std::unordered_map<uint64_t, std::vector<size_t>> meshesByHash;
+	std::vector<size_t> merged(meshes.size());
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		merged[i] = i;
+		if (excluded[i])
+			continue;
+		std::vector<size_t>& candidates = meshesByHash[hashes[i]];
+		for (size_t j : candidates) {
+			if (SameMeshContent(*meshes[i], *meshes[j])) {
+				merged[i] = j;
+				break;
+			}
+		}
+		if (merged[i] == i)
+			candidates.push_back(i);
+	}
+
+	for (GameObject* o : objects) {
+		if (o && o->mesh) {
+			size_t index = meshIndices.at(o->mesh.get());
+			if (merged[index] != index)
+				o->mesh = meshes[merged[index]];
+		}
+	}
+}
+
+const char* SceneLoadProgress::getPhaseName(int phase)
+{
+	static const char* names[] = { "Reading ZIP", "Inflating packs", "Building objects", "Decoding objects", "Reading audio and definitions", "Uploading textures" };
+	if ((size_t)phase < std::size(names))
+		return names[phase];
+	return "Done";
+}
+
+void SceneLoadProgress::enter(Phase newPhase, size_t numItems)
+{
+	checkCancel();
+	itemsTotal = numItems;
+	itemsDone = 0;
+	phase = newPhase;
+}
+
+void SceneLoadProgress::checkCancel() const
+{
+	if (cancelRequested.load(std::memory_order_relaxed))
+		throw SceneLoadCancelled();
+}
+
+float SceneLoadProgress::getFraction() const
+{
+	size_t total = itemsTotal, done = itemsDone;
+	float inPhase = total ? std::min(1.0f, (float)done / (float)total) : 0.0f;
+	return std::min(1.0f, ((float)phase + inPhase) / (float)NUM_PHASES);
+}
+
 void Scene::LoadSceneSPK(const char *fn)
 {
+	try {
+		LoadSceneData(fn);
+	}
+	catch (...) {
+		FinishLoading(); // balance the references to be destroyed along with the partly loaded scene
+		throw;
+	}
+	FinishLoading();
+}
+
+void Scene::FinishLoading()
+{
+	for (auto& [obj, count] : pendingRefCounts)
+		g_objRefCounts[obj] += count;
+	pendingRefCounts = {};
+	// the member lists of the previous scene's objects are probably not needed anymore
+	ClassInfo::ClearMemberNamesCache();
+}
+
+void Scene::LoadSceneData(const char *fn, SceneLoadProgress* progress)
+{
+	auto enterPhase = [progress](SceneLoadProgress::Phase phase, size_t numItems = 0) {
+		if (progress)
+			progress->enter(phase, numItems);
+	};
+	auto stepItem = [progress]() {
+		if (progress) {
+			progress->checkCancel();
+			progress->itemsDone.fetch_add(1, std::memory_order_relaxed);
+		}
+	};
+
 	Close();
+	bufferArena = std::make_unique<Arena>();
+	BufferAllocator::Scope arenaScope(bufferArena.get());
 
+	enterPhase(SceneLoadProgress::ZIP_READ);
 	FILE *zipfile = fopen(fn, "rb");
-	if (!zipfile) ferr("Could not open the ZIP file.");
+	if (!zipfile) throw c47editException("Could not open the ZIP file.");
 	fseek(zipfile, 0, SEEK_END);
 	size_t zipsize = ftell(zipfile);
 	fseek(zipfile, 0, SEEK_SET);
@@ -174,105 +391,134 @@ void Scene::LoadSceneSPK(const char *fn)
 	fread(zipmem.data(), zipsize, 1, zipfile);
 	fclose(zipfile);
 
-	mz_zip_archive zip; void *spkmem; size_t spksize;
-	mz_zip_zero_struct(&zip);
-	mz_bool mzreadok = mz_zip_reader_init_mem(&zip, zipmem.data(), zipsize, 0);
-	if (!mzreadok) ferr("Failed to initialize ZIP reading.");
-	spkmem = mz_zip_reader_extract_file_to_heap(&zip, "Pack.SPK", &spksize, 0);
-	if (!spkmem) ferr("Failed to extract Pack.SPK from ZIP archive.");
-	ReadAssetPacks(this, &zip);
-	mz_zip_reader_end(&zip);
-	Chunk spkchk;
-	spkchk.load(spkmem);
-	free(spkmem);
+	enterPhase(SceneLoadProgress::PACK_INFLATE);
+	ReadScenePacks(this);
+	enterPhase(SceneLoadProgress::OBJECT_BUILD);
+	// Pack.SPK is only read, so it is accessed in place instead of being copied into a Chunk tree
+	ChunkView spkchk(spkData->data());
+	ChunkViewIndex spkIndex(spkchk);
 	lastspkfn = fn;
 
-	Chunk* prot = spkchk.findSubchunk('TORP');
-	Chunk* pclp = spkchk.findSubchunk('PLCP');
-	Chunk* phea = spkchk.findSubchunk('AEHP');
-	Chunk* pnam = spkchk.findSubchunk('MANP');
-	Chunk* ppos = spkchk.findSubchunk('SOPP');
-	Chunk* pmtx = spkchk.findSubchunk('XTMP');
-	Chunk* pver = spkchk.findSubchunk('REVP');
-	Chunk* pfac = spkchk.findSubchunk('CAFP');
-	Chunk* pftx = spkchk.findSubchunk('XTFP');
-	Chunk* puvc = spkchk.findSubchunk('CVUP');
-	Chunk* pdbl = spkchk.findSubchunk('LBDP');
-	Chunk* pdat = spkchk.findSubchunk('TADP');
-	Chunk* pexc = spkchk.findSubchunk('CXEP');
+	ChunkView prot = spkIndex.find('TORP');
+	ChunkView pclp = spkIndex.find('PLCP');
+	ChunkView phea = spkIndex.find('AEHP');
+	ChunkView pnam = spkIndex.find('MANP');
+	ChunkView ppos = spkIndex.find('SOPP');
+	ChunkView pmtx = spkIndex.find('XTMP');
+	ChunkView pver = spkIndex.find('REVP');
+	ChunkView pfac = spkIndex.find('CAFP');
+	ChunkView pftx = spkIndex.find('XTFP');
+	ChunkView puvc = spkIndex.find('CVUP');
+	ChunkView pdbl = spkIndex.find('LBDP');
+	ChunkView pdat = spkIndex.find('TADP');
+	ChunkView pexc = spkIndex.find('CXEP');
 	if (!(prot && pclp && phea && pnam && ppos && pmtx && pver && pfac && pftx && puvc && pdbl && pdat && pexc))
-		ferr("One or more important chunks were not found in Pack.SPK .");
-
-	rootobj = new GameObject("Root", 0x21 /*ZROOM*/);
-	cliprootobj = new GameObject("ClipRoot", 0x21 /*ZROOM*/);
-	superroot = new GameObject("SuperRoot", 0x21);
+		throw c47editException("One or more important chunks were not found in Pack.SPK .");
+	const uint8_t* heaData = phea.maindata().data();
+	const uint8_t* namData = pnam.maindata().data();
+	const uint8_t* posData = ppos.maindata().data();
+	const uint8_t* mtxData = pmtx.maindata().data();
+	const uint8_t* verData = pver.maindata().data();
+	const uint8_t* facData = pfac.maindata().data();
+	const uint8_t* ftxData = pftx.maindata().data();
+	const uint8_t* uvcData = puvc.maindata().data();
+	const uint8_t* dblData = pdbl.maindata().data();
+	const uint8_t* datData = pdat.maindata().data();
+	const uint8_t* excData = pexc.maindata().data();
+
+	rootobj = newObject("Root", 0x21 /*ZROOM*/);
+	cliprootobj = newObject("ClipRoot", 0x21 /*ZROOM*/);
+	superroot = newObject("SuperRoot", 0x21);
 	superroot->subobj.push_back(rootobj);
 	superroot->subobj.push_back(cliprootobj);
 	rootobj->parent = cliprootobj->parent = superroot;
 	rootobj->root = rootobj;
 	cliprootobj->root = cliprootobj;
 
-	// First, create the objects and an ID<->GameObject* map.
-	std::map<uint32_t, GameObject*> idobjmap;
-	std::map<Chunk*, GameObject*> chkobjmap;
-	std::function<void(Chunk*,GameObject*)> z;
-	uint32_t objid = 1;
-	z = [this, &z, &objid, &chkobjmap, &idobjmap, &phea, &pnam](Chunk *c, GameObject *parentobj) {
-		uint32_t pheaoff = c->tag & 0xFFFFFF;
-		uint32_t *p = (uint32_t*)((char*)phea->maindata.data() + pheaoff);
-		uint32_t ot = *(unsigned short*)(&p[5]);
-		char *objname = (char*)pnam->maindata.data() + p[2];
-
-		GameObject *o = new GameObject(objname, ot);
-		chkobjmap[c] = o;
-		parentobj->subobj.push_back(o);
-		o->parent = parentobj;
-		idobjmap[objid++] = o;
-		if (c->subchunks.size() > 0)
-			for (uint32_t i = 0; i < (uint32_t)c->subchunks.size(); i++)
-				z(&c->subchunks[i], o);
-	};
-
-	auto y = [z](Chunk *c, GameObject *o) {
-		for (uint32_t i = 0; i < (uint32_t)c->subchunks.size(); i++)
-			z(&c->subchunks[i], o);
-	};
-
-	y(pclp, cliprootobj);
-	y(prot, rootobj);
-
 	using MeshKey = std::array<uint32_t, 8>;
-	auto toMeshKey = [](uint32_t* p) {
+	auto toMeshKey = [](const uint32_t* p) {
 		return MeshKey{ p[6], p[7], p[8], p[9], p[10], p[11], p[12], p[14] };
 	};
 	struct MeshKeyHash {
 		size_t operator()(const MeshKey& mi) const noexcept {
-			return mi[6];
+			uint64_t hash = 0xcbf29ce484222325;
+			for (uint32_t val : mi)
+				hash = (hash ^ val) * 0x100000001b3;
+			return (size_t)(hash ^ (hash >> 32));
 		}
 	};
 	std::unordered_map<MeshKey, std::shared_ptr<Mesh>, MeshKeyHash> meshMap;
 	std::unordered_map<MeshKey, std::shared_ptr<ObjLine>, MeshKeyHash> lineMap;
 
-	// Then read/load the object properties.
-	std::function<void(Chunk*, GameObject*)> g;
-	g = [&](Chunk *c, GameObject *parentobj) {
-		uint32_t pheaoff = c->tag & 0xFFFFFF;
-		uint32_t *p = (uint32_t*)((char*)phea->maindata.data() + pheaoff);
-		uint32_t ot = *(unsigned short*)(&p[5]);
-		const char *otname = GetObjTypeString(ot);
-		char *objname = (char*)pnam->maindata.data() + p[2];
-
-		GameObject *o = chkobjmap[c];
-		uint8_t state = (c->tag >> 24) & 255;
-		assert(state >= 0 && state < 4);
-		o->isIncludedScene = state & 2;
-		o->flags = *((unsigned short*)(&p[5]) + 1);
-		o->root = o->parent->root;
-
-		Vector3 position = *(Vector3*)((char*)ppos->maindata.data() + p[4]);
+	// Decoders of the object properties, independent for each object/mesh/line
+	// so that they can run in parallel
+	auto decodeMesh = [&](Mesh* m, const uint32_t* p) {
+		m->weird = p[14];
+
+		// the geometry is not copied, the mesh refers to it in spkData
+		const float* verts = (const float*)verData + p[6];
+		const uint16_t* quadInds = (const uint16_t*)facData + p[7];
+		const uint16_t* triInds = (const uint16_t*)facData + p[8];
+		m->vertices.reference(spkData, verts, 3 * p[10]);
+		m->quadindices.reference(spkData, quadInds, 4 * p[11]);
+		m->triindices.reference(spkData, triInds, 3 * p[12]);
+
+		uint32_t ftxo = 0;
+		if (p[9] & 0x80000000) {
+			const uint32_t* dat1 = (const uint32_t*)(datData + (p[9] & 0x7FFFFFFF));
+			ftxo = dat1[0];
+			m->extension = std::make_unique<Mesh::Extension>();
+			m->extension->extUnk2 = dat1[1];
+			const uint8_t* dat2 = datData + dat1[2];
+			const uint8_t* ptr2 = dat2;
+			uint32_t numDings = *(const uint32_t*)ptr2; ptr2 += 4;
+			m->extension->frames.resize(numDings);
+			memcpy(m->extension->frames.data(), ptr2, 8 * numDings);
+			ptr2 += numDings * 8;
+			m->extension->name = (const char*)ptr2;
+		}
+		else {
+			ftxo = p[9];
+		}
+		if (ftxo != 0) {
+			const uint8_t* ftx = ftxData + ftxo - 1;
+			uint32_t uv1off = *(const uint32_t*)ftx;
+			uint32_t uv2off = *(const uint32_t*)(ftx + 4);
+			uint32_t numFaces = *(const uint32_t*)(ftx + 8);
+			assert(numFaces == m->getNumTris() + m->getNumQuads());
+			const float* uv1 = (const float*)uvcData + uv1off;
+			const float* uv2 = (const float*)uvcData + uv2off;
+			const Mesh::FTXFace* faces = (const Mesh::FTXFace*)(ftx + 12);
+			m->ftxFaces.reference(spkData, faces, numFaces);
+			uint32_t numTexturedFaces = 0, numLitFaces = 0;
+			for (uint32_t i = 0; i < numFaces; ++i) {
+				if (faces[i][0] & 0x20)
+					numTexturedFaces += 1;
+				if (faces[i][0] & 0x80)
+					numLitFaces += 1;
+			}
+			m->textureCoords.reference(spkData, uv1, numTexturedFaces * 8);
+			m->lightCoords.reference(spkData, uv2, numLitFaces * 8);
+		}
+	};
+
+	auto decodeLine = [&](ObjLine* m, const uint32_t* p) {
+		assert(p[7] == 0 && p[11] == 0);
+
+		m->vertices.resize(3 * p[10]);
+		m->terms.resize(p[12]);
+		const float* verts = (const float*)verData + p[6];
+		memcpy(m->vertices.data(), verts, 4 * m->vertices.size());
+		memcpy(m->terms.data(), datData + p[8], 4 * m->terms.size());
+		m->ftxo = p[9];
+		m->weird = p[14];
+	};
+
+	auto decodeObject = [&](GameObject *o, const uint32_t *p) {
+		Vector3 position = *(const Vector3*)(posData + p[4]);
 		o->matrix = Matrix::getTranslationMatrix(position);
 		float mc[4];
-		int32_t *mtxoff  = (int32_t*)pmtx->maindata.data() + p[3] * 4;
+		const int32_t *mtxoff  = (const int32_t*)mtxData + p[3] * 4;
 		for (int i = 0; i < 4; i++)
 			mc[i] = (float)((double)mtxoff[i] / 1073741824.0); // divide by 2^30
 		Vector3 rv[3];
@@ -285,163 +531,174 @@ void Scene::LoadSceneSPK(const char *fn)
 			for (int j = 0; j < 3; j++)
 				o->matrix.m[i][j] = rv[i].coord[j];
 
-		if (o->flags & 0x0020)
+		if (o->flags & 0x0080)
 		{
+			o->light = newComponent<Light>();
+			for (int i = 0; i < 7; i++)
+				o->light->param[i] = p[6 + i];
+		}
+
+		uint32_t pexcoff = p[1];
+		if (pexcoff != 0) {
+			o->excChunk = std::make_shared<Chunk>();
+			o->excChunk->load(excData + pexcoff - 1);
+		}
+	};
+
+	// Create the object hierarchy in a pre-order walk, without recursion.
+	// The objects are given sequential IDs in that order,
+	// so the ID is directly the index in idobjs (0 being the null reference).
+	std::vector<GameObject*> idobjs = { nullptr };
+	std::vector<const uint32_t*> idheaders = { nullptr };
+	struct WalkLevel {
+		ChunkView::SubchunkIterator next, end;
+		GameObject* parent;
+	};
+	std::vector<WalkLevel> walk;
+	for (auto [top, topobj] : { std::make_pair(pclp, cliprootobj), std::make_pair(prot, rootobj) }) {
+		auto topRange = top.subchunks();
+		walk.push_back({ topRange.begin(), topRange.end(), topobj });
+		while (!walk.empty()) {
+			WalkLevel& level = walk.back();
+			if (!(level.next != level.end)) {
+				walk.pop_back();
+				continue;
+			}
+			ChunkView c = *level.next;
+			++level.next;
+			GameObject* parentobj = level.parent;
+
+			const uint32_t *p = (const uint32_t*)(heaData + (c.tag() & 0xFFFFFF));
+			uint32_t ot = *(const unsigned short*)(&p[5]);
+			const char *objname = (const char*)namData + p[2];
+
+			GameObject *o = newObject(objname, ot);
+			parentobj->subobj.push_back(o);
+			o->parent = parentobj;
+			o->root = parentobj->root;
+			uint8_t state = (c.tag() >> 24) & 255;
+			assert(state >= 0 && state < 4);
+			o->isIncludedScene = state & 2;
+			o->flags = *((const unsigned short*)(&p[5]) + 1);
+			idobjs.push_back(o);
+			idheaders.push_back(p);
+
+			auto subRange = c.subchunks();
+			walk.push_back({ subRange.begin(), subRange.end(), o });
+		}
+	}
+
+	// Objects with the same mesh/line share it, so each one is only decoded once.
+	std::vector<std::pair<Mesh*, const uint32_t*>> meshesToDecode;
+	std::vector<std::pair<ObjLine*, const uint32_t*>> linesToDecode;
+	for (size_t id = 1; id < idobjs.size(); ++id) {
+		GameObject* o = idobjs[id];
+		const uint32_t* p = idheaders[id];
+		if (o->flags & 0x0020) {
 			o->color = p[13];
-			auto mi = toMeshKey(p);
-			auto [meshIt, isFirstTime] = meshMap.try_emplace(mi);
+			auto [meshIt, isFirstTime] = meshMap.try_emplace(toMeshKey(p));
 			if (isFirstTime) {
-				meshIt->second = std::make_shared<Mesh>();
-				Mesh* m = meshIt->second.get();
-				m->weird = p[14];
-
-				float* verts = (float*)pver->maindata.data() + p[6];
-				uint16_t* quadInds = (uint16_t*)pfac->maindata.data() + p[7];
-				uint16_t* triInds = (uint16_t*)pfac->maindata.data() + p[8];
-				m->vertices.resize(3 * p[10]);
-				m->quadindices.resize(4 * p[11]);
-				m->triindices.resize(3 * p[12]);
-				memcpy(m->vertices.data(), verts, 4 * m->vertices.size());
-				memcpy(m->quadindices.data(), quadInds, 2 * m->quadindices.size());
-				memcpy(m->triindices.data(), triInds, 2 * m->triindices.size());
-
-				uint32_t ftxo = 0;
-				if (p[9] & 0x80000000) {
-					uint32_t* dat1 = (uint32_t*)(pdat->maindata.data() + (p[9] & 0x7FFFFFFF));
-					ftxo = dat1[0];
-					m->extension = std::make_unique<Mesh::Extension>();
-					m->extension->extUnk2 = dat1[1];
-					uint8_t* dat2 = pdat->maindata.data() + dat1[2];
-					uint8_t* ptr2 = dat2;
-					uint32_t numDings = *(uint32_t*)ptr2; ptr2 += 4;
-					m->extension->frames.resize(numDings);
-					memcpy(m->extension->frames.data(), ptr2, 8 * numDings);
-					ptr2 += numDings * 8;
-					m->extension->name = (const char*)ptr2;
-				}
-				else {
-					ftxo = p[9];
-				}
-				if (ftxo != 0) {
-					uint8_t* ftx = pftx->maindata.data() + ftxo - 1;
-					uint32_t uv1off = *(uint32_t*)ftx;
-					uint32_t uv2off = *(uint32_t*)(ftx + 4);
-					uint32_t numFaces = *(uint32_t*)(ftx + 8);
-					assert(numFaces == m->getNumTris() + m->getNumQuads());
-					float* uv1 = (float*)puvc->maindata.data() + uv1off;
-					float* uv2 = (float*)puvc->maindata.data() + uv2off;
-					m->ftxFaces.resize(numFaces);
-					memcpy(m->ftxFaces.data(), ftx + 12, numFaces * 12);
-					uint32_t numTexturedFaces = 0, numLitFaces = 0;
-					for (auto& face : m->ftxFaces) {
-						if (face[0] & 0x20)
-							numTexturedFaces += 1;
-						if (face[0] & 0x80)
-							numLitFaces += 1;
-					}
-					m->textureCoords.resize(numTexturedFaces * 8);
-					m->lightCoords.resize(numLitFaces * 8);
-					memcpy(m->textureCoords.data(), uv1, numTexturedFaces * 8 * 4);
-					memcpy(m->lightCoords.data(), uv2, numLitFaces * 8 * 4);
-				}
+				meshIt->second = newComponent<Mesh>();
+				meshesToDecode.emplace_back(meshIt->second.get(), p);
 			}
 			o->mesh = meshIt->second;
 		}
-
-		if (o->flags & 0x0400)
-		{
+		if (o->flags & 0x0400) {
 			o->color = p[13];
-			auto mi = toMeshKey(p);
-			auto [lineIt, isFirstTime] = lineMap.try_emplace(mi);
+			auto [lineIt, isFirstTime] = lineMap.try_emplace(toMeshKey(p));
 			if (isFirstTime) {
-				lineIt->second = std::make_shared<ObjLine>();
-				ObjLine* m = lineIt->second.get();
-				assert(p[7] == 0 && p[11] == 0);
-
-				m->vertices.resize(3 * p[10]);
-				m->terms.resize(p[12]);
-				float* verts = (float*)pver->maindata.data() + p[6];
-				memcpy(m->vertices.data(), verts, 4 * m->vertices.size());
-				memcpy(m->terms.data(), pdat->maindata.data() + p[8], 4 * m->terms.size());
-				m->ftxo = p[9];
-				m->weird = p[14];
+				lineIt->second = newComponent<ObjLine>();
+				linesToDecode.emplace_back(lineIt->second.get(), p);
 			}
 			o->line = lineIt->second;
 		}
+	}
 
-		if (o->flags & 0x0080)
-		{
-			o->light = std::make_shared<Light>();
-			for (int i = 0; i < 7; i++)
-				o->light->param[i] = p[6 + i];
-		}
-
-		uint8_t* dpbeg = pdbl->maindata.data() + p[0];
-		o->dbl.load(dpbeg, idobjmap);
-
-		uint32_t pexcoff = p[1];
-		if (pexcoff != 0) {
-			o->excChunk = std::make_shared<Chunk>();
-			o->excChunk->load(pexc->maindata.data() + pexcoff - 1);
-		}
-
-		if (c->subchunks.size() > 0)
-		{
-			for (uint32_t i = 0; i < (uint32_t)c->subchunks.size(); i++)
-				g(&c->subchunks[i], o);
+	enterPhase(SceneLoadProgress::OBJECT_DECODE, meshesToDecode.size() + linesToDecode.size() + idobjs.size() - 1);
+	ParallelFor(meshesToDecode.size(), [&](size_t i) {
+		stepItem();
+		decodeMesh(meshesToDecode[i].first, meshesToDecode[i].second);
+	});
+	ParallelFor(linesToDecode.size(), [&](size_t i) {
+		stepItem();
+		decodeLine(linesToDecode[i].first, linesToDecode[i].second);
+	});
+
+	// The DBLs can reference any object, so they are loaded once all objects exist.
+	// The global ref counts must not be changed here (several threads, and maybe not the main one),
+	// so the references are counted per object ID and added by FinishLoading.
+	std::vector<std::atomic<uint32_t>> dblRefCounts(idobjs.size());
+	// Recorded even if loading stops early, as destroying the uncounted refs will still decrement their counts
+	struct PendingRefCountsRecorder {
+		Scene* scene;
+		const std::vector<GameObject*>& idobjs;
+		const std::vector<std::atomic<uint32_t>>& counts;
+		~PendingRefCountsRecorder() {
+			for (size_t id = 1; id < idobjs.size(); ++id)
+				if (uint32_t count = counts[id].load(std::memory_order_relaxed))
+					scene->pendingRefCounts.emplace_back(idobjs[id], count);
 		}
-	};
+	} pendingRefCountsRecorder{ this, idobjs, dblRefCounts };
+	ParallelFor(idobjs.size() - 1, [&](size_t i) {
+		stepItem();
+		BufferAllocator::Scope arenaScope(bufferArena.get());
+		GameObject* o = idobjs[i + 1];
+		const uint32_t* p = idheaders[i + 1];
+		decodeObject(o, p);
+		o->dbl.load(dblData + p[0], idobjs, dblRefCounts.data(), spkData);
+	});
 
-	auto f = [g](Chunk *c, GameObject *o) {
-		for (uint32_t i = 0; i < (uint32_t)c->subchunks.size(); i++)
-			g(&c->subchunks[i], o);
-	};
+	if (mergeIdenticalMeshes)
+		MergeIdenticalMeshes(idobjs);
 
-	f(pclp, cliprootobj);
-	f(prot, rootobj);
+	enterPhase(SceneLoadProgress::AUDIO);
 
 	// Audio objects
-	Chunk* ands = spkchk.findSubchunk('SDNA');
-	Chunk* sndr = spkchk.findSubchunk('RDNS');
+	ChunkView ands = spkIndex.find('SDNA');
+	ChunkView sndr = spkIndex.find('RDNS');
 	assert(ands && sndr);
-	audioMgr.load(*ands, *sndr);
+	audioMgr.load(ands, sndr);
 
 	// ZDefines
-	Chunk* zdef = spkchk.findSubchunk('FEDZ');
+	ChunkView zdef = spkIndex.find('FEDZ');
 	assert(zdef);
-	zdefNames = (const char*)zdef->multidata[0].data();
-	zdefValues.load(zdef->multidata[1].data(), idobjmap);
-	zdefTypes = (const char*)zdef->multidata[2].data();
+	zdefNames = (const char*)zdef.multidata(0).data();
+	zdefValues.load(zdef.multidata(1).data(), idobjs, dblRefCounts.data(), spkData);
+	zdefTypes = (const char*)zdef.multidata(2).data();
 
 	// Messages
-	Chunk* msgv = spkchk.findSubchunk('VGSM');
-	for (Chunk& msg : msgv->subchunks) {
-		uint32_t id = msg.tag;
-		msgDefinitions[id] = std::make_pair((char*)msg.multidata[0].data(), (char*)msg.multidata[1].data());
+	ChunkView msgv = spkIndex.find('VGSM');
+	for (ChunkView msg : msgv.subchunks()) {
+		uint32_t id = msg.tag();
+		msgDefinitions[id] = std::make_pair((const char*)msg.multidata(0).data(), (const char*)msg.multidata(1).data());
 	}
 
 	// Texture to material assignment map
-	Chunk* matl = spkchk.findSubchunk('LTAM');
+	ChunkView matl = spkIndex.find('LTAM');
 	assert(matl);
-	Chunk* mtlv = matl->findSubchunk('VLTM');
-	assert(mtlv && mtlv->maindata.size() == 4 && *(uint32_t*)mtlv->maindata.data() == 1);
-	for (size_t i = 0; i < matl->multidata.size(); i += 3) {
-		textureMaterialMap.emplace_back((char*)matl->multidata[i].data(), (char*)matl->multidata[i + 1].data(), *(uint32_t*)matl->multidata[i + 2].data());
+	ChunkView mtlv = matl.findSubchunk('VLTM');
+	assert(mtlv && mtlv.maindata().size() == 4 && *(const uint32_t*)mtlv.maindata().data() == 1);
+	auto matlRange = matl.multidata();
+	for (auto matlIt = matlRange.begin(); matlIt != matlRange.end(); ++matlIt) {
+		const char* texName = (const char*)(*matlIt).data();
+		const char* matName = (const char*)(*++matlIt).data();
+		uint32_t num = *(const uint32_t*)(*++matlIt).data();
+		textureMaterialMap.emplace_back(texName, matName, num);
 	}
 
 	// Texture info (last ID)
-	Chunk* ptxi = spkchk.findSubchunk('IXTP');
-	numTextures = *(uint32_t*)ptxi->maindata.data();
+	ChunkView ptxi = spkIndex.find('IXTP');
+	numTextures = *(const uint32_t*)ptxi.maindata().data();
 
 	// Info string lists
-	Chunk* pzfi = spkchk.findSubchunk('IFZP');
-	Chunk* dlcf = spkchk.findSubchunk('FCLD');
-	Chunk* spat = spkchk.findSubchunk('TAPS');
+	ChunkView pzfi = spkIndex.find('IFZP');
+	ChunkView dlcf = spkIndex.find('FCLD');
+	ChunkView spat = spkIndex.find('TAPS');
 	assert(pzfi && dlcf && spat);
-	auto loadStrList = [](std::vector<std::string>& vec, Chunk* chk) {
-		if (chk->maindata.size())
-			vec.emplace_back((const char*)chk->maindata.data());
-		for (auto& dat : chk->multidata)
+	auto loadStrList = [](std::vector<std::string>& vec, ChunkView chk) {
+		if (chk.maindata().size())
+			vec.emplace_back((const char*)chk.maindata().data());
+		for (ByteSpan dat : chk.multidata())
 			vec.emplace_back((const char*)dat.data());
 	};
 	loadStrList(zipFilesIncluded, pzfi);
@@ -456,13 +713,16 @@ void Scene::LoadSceneSPK(const char *fn)
 		'FEDZ', 'VGSM', 'LTAM', 'IXTP',
 		'IFZP', 'FCLD', 'TAPS'
 	};
-	for (auto& chk : spkchk.subchunks) {
-		if (std::find(std::begin(knownChunks), std::end(knownChunks), chk.tag) == std::end(knownChunks)) {
-			remainingChunks.push_back(std::move(chk)); // move since spkchk is going to be destroyed anyway
+	std::vector<bool> isKnown(spkIndex.subchunks.size(), false);
+	for (uint32_t tag : knownChunks)
+		for (const auto& entry : spkIndex.findAll(tag))
+			isKnown[entry.second] = true;
+	for (size_t i = 0; i < spkIndex.subchunks.size(); i++) {
+		if (!isKnown[i]) {
+			remainingChunks.emplace_back().load(spkIndex.subchunks[i]);
 		}
 	}
 
-	oldSpkChunk = std::move(spkchk);
 	ready = true;
 }
 
@@ -475,33 +735,180 @@ struct DBLHash
 	}
 };
 
-template<typename Unit, uint32_t OffsetUnit, bool IncludeStringNullTerminator = false>
-struct PackBuffer {
-	using Elem = typename Unit::value_type;
+// Buffer of a Pack chunk (PVER, PNAM, ...) in which identical elements are only stored once.
+// Elements are found by a hash of their content, confirmed by comparing with the bytes
+// already in the buffer, so no copy of the elements is kept aside.
+struct PackBufferBase {
+	struct Entry {
+		uint32_t offset, size;
+		uint64_t hash;
+		uint8_t kind;
+	};
 
+	const uint32_t offsetUnit;
 	std::vector<uint8_t> buffer;
-	std::map<Unit, uint32_t> offmap;
+	std::vector<Entry> entries; // every distinct element, in order of addition
+	// content hash -> index in entries.
+	// Elements of different kinds are never shared, as they might be modified differently later.
+	std::unordered_multimap<uint64_t, uint32_t> entriesByHash;
+
+	explicit PackBufferBase(uint32_t offsetUnit) : offsetUnit(offsetUnit) {}
+
+	static uint64_t hashBytes(const uint8_t* data, size_t size) {
+		uint64_t hash = 0x9E3779B97F4A7C15 ^ size;
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8) {
+			uint64_t word;
+			memcpy(&word, data + i, 8);
+			hash = (hash ^ word) * 0xFF51AFD7ED558CCD;
+			hash ^= hash >> 32;
+		}
+		uint64_t tail = 0;
+		memcpy(&tail, data + i, size - i);
+		hash = (hash ^ tail) * 0xFF51AFD7ED558CCD;
+		return hash ^ (hash >> 29);
+	}
 
-	[[nodiscard]] uint32_t addByteOffset(const Unit& elem) {
-		auto [it, inserted] = offmap.try_emplace(elem, (uint32_t)buffer.size());
-		if (inserted) {
-			uint8_t* ptr = (uint8_t*)std::data(elem);
-			size_t len = sizeof(Elem) * (std::size(elem) + (IncludeStringNullTerminator ? 1 : 0));
-			buffer.insert(buffer.end(), ptr, ptr + len);
+	[[nodiscard]] uint32_t addByteOffset(const void* data, size_t len, uint64_t hash, uint8_t kind) {
+		const uint8_t* ptr = (const uint8_t*)data;
+		auto [first, last] = entriesByHash.equal_range(hash);
+		for (auto it = first; it != last; ++it) {
+			const Entry& entry = entries[it->second];
+			if (entry.size == len && entry.kind == kind && !memcmp(buffer.data() + entry.offset, ptr, len))
+				return entry.offset;
 		}
-		return it->second;
+		uint32_t offset = (uint32_t)buffer.size();
+		buffer.insert(buffer.end(), ptr, ptr + len);
+		entriesByHash.emplace(hash, (uint32_t)entries.size());
+		entries.push_back({ offset, (uint32_t)len, hash, kind });
+		return offset;
+	}
+	[[nodiscard]] uint32_t addByteOffset(const void* data, size_t len, uint8_t kind = 0) {
+		return addByteOffset(data, len, hashBytes((const uint8_t*)data, len), kind);
+	}
+
+	// Adds the elements of another buffer in order, deduplicated with this buffer's elements.
+	// patch(entry, bytes) can return a modified copy of an element's bytes (relocated offsets),
+	// or nullptr to keep it as is.
+	// newOffsets receives the byte offset in this buffer of each of the other buffer's entries,
+	// it is filled progressively, so patch can relocate offsets to the entries before the current one.
+	template <class Patch> void merge(const PackBufferBase& other, std::vector<uint32_t>& newOffsets, const Patch& patch) {
+		newOffsets.resize(other.entries.size());
+		for (size_t i = 0; i < other.entries.size(); ++i) {
+			const Entry& entry = other.entries[i];
+			const uint8_t* bytes = other.buffer.data() + entry.offset;
+			if (const uint8_t* patched = patch(entry, bytes))
+				newOffsets[i] = addByteOffset(patched, entry.size, entry.kind);
+			else
+				newOffsets[i] = addByteOffset(bytes, entry.size, entry.hash, entry.kind);
+		}
+	}
+	void merge(const PackBufferBase& other, std::vector<uint32_t>& newOffsets) {
+		merge(other, newOffsets, [](const Entry&, const uint8_t*) -> const uint8_t* { return nullptr; });
 	}
-	[[nodiscard]] uint32_t add(const Unit& elem) {
-		return addByteOffset(elem) / OffsetUnit;
+
+	// Byte offset in this buffer of an element of other after merge(other, newOffsets)
+	static uint32_t relocate(const PackBufferBase& other, const std::vector<uint32_t>& newOffsets, uint32_t byteOffset) {
+		auto it = std::lower_bound(other.entries.begin(), other.entries.end(), byteOffset, [](const Entry& entry, uint32_t offset) { return entry.offset < offset; });
+		assert(it != other.entries.end() && it->offset == byteOffset);
+		return newOffsets[it - other.entries.begin()];
+	}
+
+	// Lays the elements out again, with every element that is the end of another one
+	// stored at the end of it instead of separately, if canShare(entry) allows both.
+	// Returns the new buffer, newOffsets receives the new byte offset of every entry.
+	template <class CanShare> std::vector<uint8_t> shareTails(std::vector<uint32_t>& newOffsets, const CanShare& canShare) const {
+		// Sorted by their reversed bytes, the elements ending with an element come right after it
+		std::vector<uint32_t> order;
+		for (uint32_t i = 0; i < (uint32_t)entries.size(); ++i)
+			if (canShare(entries[i]))
+				order.push_back(i);
+		auto endOf = [this](uint32_t index) { return buffer.data() + entries[index].offset + entries[index].size; };
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			const uint8_t* endA = endOf(a), * endB = endOf(b);
+			uint32_t len = std::min(entries[a].size, entries[b].size);
+			for (uint32_t k = 1; k <= len; ++k)
+				if (endA[-(int)k] != endB[-(int)k])
+					return endA[-(int)k] < endB[-(int)k];
+			return entries[a].size < entries[b].size;
+		});
+		std::vector<uint32_t> host(entries.size());
+		for (uint32_t i = 0; i < (uint32_t)entries.size(); ++i)
+			host[i] = i;
+		for (size_t k = order.size(); k-- > 1;) {
+			uint32_t tail = order[k - 1], next = order[k];
+			uint32_t len = entries[tail].size;
+			if (len <= entries[next].size && !memcmp(endOf(tail) - len, endOf(next) - len, len))
+				host[tail] = host[next];
+		}
+
+		std::vector<uint8_t> newBuffer;
+		newBuffer.reserve(buffer.size());
+		newOffsets.resize(entries.size());
+		for (uint32_t i = 0; i < (uint32_t)entries.size(); ++i) {
+			if (host[i] == i) {
+				newOffsets[i] = (uint32_t)newBuffer.size();
+				newBuffer.insert(newBuffer.end(), buffer.data() + entries[i].offset, endOf(i));
+			}
+		}
+		for (uint32_t i = 0; i < (uint32_t)entries.size(); ++i)
+			if (host[i] != i)
+				newOffsets[i] = newOffsets[host[i]] + entries[host[i]].size - entries[i].size;
+		return newBuffer;
 	}
 };
 
+template<typename Unit, uint32_t OffsetUnit, bool IncludeStringNullTerminator = false>
+struct PackBuffer : PackBufferBase {
+	using Elem = typename Unit::value_type;
+
+	PackBuffer() : PackBufferBase(OffsetUnit) {}
+
+	[[nodiscard]] uint32_t add(const Unit& elem, uint8_t kind = 0) {
+		return addByteOffset(std::data(elem), sizeof(Elem) * (std::size(elem) + (IncludeStringNullTerminator ? 1 : 0)), kind) / OffsetUnit;
+	}
+	[[nodiscard]] uint32_t add(Span<const Elem> elems) {
+		static_assert(!IncludeStringNullTerminator);
+		return addByteOffset(elems.data(), sizeof(Elem) * elems.size()) / OffsetUnit;
+	}
+};
+
+// Whether the chunk serializes to the given bytes, compared while the chunk is written instead of building a new string
+static bool ChunkMatchesEncoding(const Chunk& chunk, std::string_view encoded)
+{
+	size_t position = 0;
+	bool same = true;
+	chunk.save([&](const void* data, size_t length) {
+		same = same && position + length <= encoded.size() && !memcmp(encoded.data() + position, data, length);
+		position += length;
+	});
+	return same && position == encoded.size();
+}
+
 // Struct with all variables used when saving a Scene.
+// Parts of the scene can be saved concurrently by partial savers,
+// which are then merged into the complete saver.
 struct SceneSaver {
-	uint32_t moc_objcount;
-	std::map<GameObject*, uint32_t> objidmap;
+	enum PackId : uint8_t { NAM, POS, MTX, DBL, VER, FAC, DAT, FTX, UVC, EXC, NUM_PACKS };
+	// Kinds of elements in PDAT
+	enum DatKind : uint8_t { DAT_DATA, DAT_MESH_EXTENSION };
+	// Offset to a pack element in heabuf, stored as (byte offset / unit + bias) | flag
+	struct OffsetFixup {
+		uint32_t position;
+		PackId pack;
+		uint8_t bias;
+		uint32_t flag;
+	};
+
+	// IDs of the objects, indexed by their slot in the scene's object pool (0 if not saved)
+	const SlabPool<GameObject>* objectPool;
+	const std::vector<uint32_t>* objIds;
+	const bool partial;
+	uint32_t moc_objcount = 0;
+	uint32_t numDanglingRefs = 0; // references to objects that are not saved, written as 0
 
 	ByteWriter<std::vector<uint8_t>> heabuf;
+	std::vector<OffsetFixup> heaFixups;
 	PackBuffer<std::array<float, 3>, 1> posPackBuf;
 	PackBuffer<std::array<uint32_t, 4>, 16> mtxPackBuf;
 	PackBuffer<std::string, 1, true> namPackBuf;
@@ -513,6 +920,44 @@ struct SceneSaver {
 	PackBuffer<std::vector<float>, 4> uvcPackBuf;
 	PackBuffer<std::string, 1> excPackBuf;
 
+	SceneSaver(const SlabPool<GameObject>* objectPool, const std::vector<uint32_t>* objIds, bool partial = false)
+		: objectPool(objectPool), objIds(objIds), partial(partial) {}
+
+	// ID of a referenced object in the saved scene, 0 for none.
+	// Objects that were deleted or are outside of the scene are counted in numDanglingRefs.
+	uint32_t getObjId(GameObject* obj) {
+		if (!obj)
+			return 0;
+		size_t index = objectPool->indexOf(obj);
+		uint32_t id = objectPool->isAlive(index) ? (*objIds)[index] : 0;
+		if (id == 0)
+			numDanglingRefs += 1;
+		return id;
+	}
+
+	const PackBufferBase& getPack(PackId id) const {
+		switch (id) {
+		case NAM: return namPackBuf;
+		case POS: return posPackBuf;
+		case MTX: return mtxPackBuf;
+		case DBL: return dblPackBuf;
+		case VER: return verPackBuf;
+		case FAC: return facPackBuf;
+		case DAT: return datPackBuf;
+		case FTX: return ftxPackBuf;
+		case UVC: return uvcPackBuf;
+		default: return excPackBuf;
+		}
+	}
+	PackBufferBase& getPack(PackId id) { return const_cast<PackBufferBase&>(std::as_const(*this).getPack(id)); }
+
+	// present is false when value doesn't refer to any element (e.g. 0 for none)
+	void addHeaderOffset(bool present, PackId pack, uint32_t value, uint8_t bias = 0, uint32_t flag = 0) {
+		if (present)
+			heaFixups.push_back({ (uint32_t)heabuf.size(), pack, bias, flag });
+		heabuf.addU32(value);
+	}
+
 	void MakeObjChunk(Chunk* c, GameObject* o, bool isclp)
 	{
 		moc_objcount++;
@@ -533,9 +978,35 @@ struct SceneSaver {
 		if (o->matrix._23 < 0) cmtx[2] |= 1;
 		uint32_t mtxoff = mtxPackBuf.add(cmtx);
 
-		// DBL
-		std::string dblsav = o->dbl.save(*this);
-		uint32_t dbloff = dblPackBuf.add(dblsav);
+		// DBL, encoded again only if the object's properties were modified since the last save.
+		// The cached DBL only needs the IDs of the referenced objects to be updated.
+		GameObject::SavedRecord* record = o->saveCache.record.get();
+		if (record) {
+			bool idsChanged = false;
+			for (auto& [position, refObj] : record->dblRefs) {
+				uint32_t& storedId = *(uint32_t*)(record->dbl.data() + position);
+				uint32_t id = getObjId(refObj);
+				if (storedId != id) {
+					storedId = id;
+					idsChanged = true;
+				}
+			}
+			if (idsChanged)
+				record->dblHash = PackBufferBase::hashBytes((const uint8_t*)record->dbl.data(), record->dbl.size());
+		}
+		else {
+			o->saveCache.record = std::make_unique<GameObject::SavedRecord>();
+			record = o->saveCache.record.get();
+			record->dbl = o->dbl.save(*this, &record->dblRefs);
+			record->dblHash = PackBufferBase::hashBytes((const uint8_t*)record->dbl.data(), record->dbl.size());
+		}
+		// EXC, encoded again if its content differs from the last encoding
+		// (the chunk can be shared by several objects and edited in place through any of them)
+		if (o->excChunk && !ChunkMatchesEncoding(*o->excChunk, record->excData)) {
+			record->excData = o->excChunk->saveToString();
+			record->excHash = PackBufferBase::hashBytes((const uint8_t*)record->excData.data(), record->excData.size());
+		}
+		uint32_t dbloff = dblPackBuf.addByteOffset(record->dbl.data(), record->dbl.size(), record->dblHash, 0);
 
 		// Name
 		uint32_t namoff = namPackBuf.add(o->name);
@@ -543,49 +1014,52 @@ struct SceneSaver {
 		// Vertices (Mesh+Line)
 		uint32_t veroff = 0, trifacoff = 0, quadfacoff = 0, linetermoff = 0, ftxoff = 0;
 		assert(!(o->mesh && o->line));
+		// read through const, so that the geometry referring to the SPK isn't copied
+		const Mesh* mesh = o->mesh.get();
 		if (o->mesh || o->line) {
-			const auto& vertices = o->mesh ? o->mesh->vertices : o->line->vertices;
+			Span<const float> vertices = mesh ? mesh->vertices.view() : Span<const float>(o->line->vertices.data(), o->line->vertices.size());
 			if (!vertices.empty()) {
 				veroff = verPackBuf.add(vertices);
 			}
 		}
 
 		// Mesh
-		if (o->mesh) {
-			if (!o->mesh->triindices.empty()) {
-				trifacoff = facPackBuf.add(o->mesh->triindices);
+		if (mesh) {
+			if (!mesh->triindices.empty()) {
+				trifacoff = facPackBuf.add(mesh->triindices.view());
 			}
-			if (!o->mesh->quadindices.empty()) {
-				quadfacoff = facPackBuf.add(o->mesh->quadindices);
+			if (!mesh->quadindices.empty()) {
+				quadfacoff = facPackBuf.add(mesh->quadindices.view());
 			}
 			uint32_t realftxoff = 0;
-			if (!o->mesh->ftxFaces.empty()) {
-				uint32_t tcOff = 0, lcOff = 0;
-				if (!o->mesh->textureCoords.empty()) {
-					tcOff = uvcPackBuf.add(o->mesh->textureCoords);
+			if (!mesh->ftxFaces.empty()) {
+				// a partial saver stores the PUVC offsets +1, to tell offset 0 apart from no coordinates until merged
+				uint32_t tcOff = 0, lcOff = 0, uvcBias = partial ? 1 : 0;
+				if (!mesh->textureCoords.empty()) {
+					tcOff = uvcPackBuf.add(mesh->textureCoords.view()) + uvcBias;
 				}
-				if (!o->mesh->lightCoords.empty()) {
-					lcOff = uvcPackBuf.add(o->mesh->lightCoords);
+				if (!mesh->lightCoords.empty()) {
+					lcOff = uvcPackBuf.add(mesh->lightCoords.view()) + uvcBias;
 				}
 				ByteWriter<std::string> sb;
-				uint32_t numFaces = (uint32_t)o->mesh->ftxFaces.size();
+				uint32_t numFaces = (uint32_t)mesh->ftxFaces.size();
 				std::array<uint32_t, 3> header = { tcOff, lcOff, numFaces };
 				sb.addData(header.data(), 12);
-				sb.addData(o->mesh->ftxFaces.data(), numFaces * 12);
+				sb.addData(mesh->ftxFaces.data(), numFaces * 12);
 				realftxoff = ftxPackBuf.add(sb.take()) + 1;
 			}
-			if (o->mesh->extension) {
+			if (mesh->extension) {
 				ByteWriter<std::string> sb;
-				uint32_t numFrames = o->mesh->extension->frames.size();
+				uint32_t numFrames = mesh->extension->frames.size();
 				sb.addU32(numFrames);
-				for (auto& [p1, p2] : o->mesh->extension->frames) {
+				for (auto& [p1, p2] : mesh->extension->frames) {
 					sb.addU32(p1);
 					sb.addU32(p2);
 				}
-				sb.addStringNT(o->mesh->extension->name);
+				sb.addStringNT(mesh->extension->name);
 				uint32_t ext2off = datPackBuf.add(sb.take());
-				std::array<uint32_t, 3> ext1 = { realftxoff, o->mesh->extension->extUnk2, ext2off };
-				uint32_t ext1off = datPackBuf.add(std::string{ (char*)ext1.data(), 12 });
+				std::array<uint32_t, 3> ext1 = { realftxoff, mesh->extension->extUnk2, ext2off };
+				uint32_t ext1off = datPackBuf.add(std::string{ (char*)ext1.data(), 12 }, DAT_MESH_EXTENSION);
 				ftxoff = ext1off | 0x80000000;
 			}
 			else {
@@ -604,25 +1078,28 @@ struct SceneSaver {
 		// EXC
 		uint32_t pexcoff = 0;
 		if (o->excChunk) {
-			pexcoff = excPackBuf.add(o->excChunk->saveToString()) + 1;
+			pexcoff = excPackBuf.addByteOffset(record->excData.data(), record->excData.size(), record->excHash, 0) + 1;
 		}
 
 		// Object Header
 		uint32_t heaoff = (uint32_t)heabuf.size();
-		heabuf.addU32(dbloff);
-		heabuf.addU32(pexcoff);
-		heabuf.addU32(namoff);
-		heabuf.addU32(mtxoff);
-		heabuf.addU32(posoff);
+		addHeaderOffset(true, DBL, dbloff);
+		addHeaderOffset(o->excChunk != nullptr, EXC, pexcoff, 1);
+		addHeaderOffset(true, NAM, namoff);
+		addHeaderOffset(true, MTX, mtxoff);
+		addHeaderOffset(true, POS, posoff);
 		heabuf.addU16(o->type);
 		heabuf.addU16(o->flags);
 		if (o->flags & 0x0020)
 		{
 			assert(o->mesh);
-			heabuf.addU32(veroff);
-			heabuf.addU32(quadfacoff);
-			heabuf.addU32(trifacoff);
-			heabuf.addU32(ftxoff);
+			addHeaderOffset(!mesh->vertices.empty(), VER, veroff);
+			addHeaderOffset(!mesh->quadindices.empty(), FAC, quadfacoff);
+			addHeaderOffset(!mesh->triindices.empty(), FAC, trifacoff);
+			if (mesh->extension)
+				addHeaderOffset(true, DAT, ftxoff, 0, 0x80000000);
+			else
+				addHeaderOffset(!mesh->ftxFaces.empty(), FTX, ftxoff, 1);
 			uint32_t versize = o->mesh->getNumVertices();
 			uint32_t quadsize = o->mesh->getNumQuads();
 			uint32_t trisize = o->mesh->getNumTris();
@@ -636,9 +1113,9 @@ struct SceneSaver {
 		{
 			assert(o->line);
 			uint32_t zero = 0;
-			heabuf.addU32(veroff);
+			addHeaderOffset(!o->line->vertices.empty(), VER, veroff);
 			heabuf.addU32(zero);
-			heabuf.addU32(linetermoff);
+			addHeaderOffset(!o->line->terms.empty(), DAT, linetermoff);
 			heabuf.addU32(o->line->ftxo);
 			uint32_t versize = o->line->getNumVertices();
 			uint32_t termsize = o->line->terms.size();
@@ -668,42 +1145,201 @@ struct SceneSaver {
 			i++;
 		}
 	}
+
+	// Appends the objects saved by a partial saver, whose chunks are given,
+	// and relocates their offsets to the elements merged into this saver's packs
+	void merge(const SceneSaver& part, Span<Chunk> chunks)
+	{
+		std::array<std::vector<uint32_t>, NUM_PACKS> newOffsets;
+		auto relocate = [&](PackId pack, uint32_t byteOffset) {
+			return PackBufferBase::relocate(part.getPack(pack), newOffsets[pack], byteOffset);
+		};
+		for (PackId pack : { NAM, POS, MTX, DBL, VER, FAC, UVC, EXC })
+			getPack(pack).merge(part.getPack(pack), newOffsets[pack]);
+
+		// FTX elements start with their texture and light coordinates offsets into PUVC (+1 in the partial saver)
+		std::vector<uint8_t> patched;
+		ftxPackBuf.merge(part.ftxPackBuf, newOffsets[FTX], [&](const PackBufferBase::Entry& entry, const uint8_t* bytes) {
+			patched.assign(bytes, bytes + entry.size);
+			uint32_t* uvcOffsets = (uint32_t*)patched.data();
+			for (int i = 0; i < 2; ++i)
+				if (uvcOffsets[i] != 0)
+					uvcOffsets[i] = relocate(UVC, (uvcOffsets[i] - 1) * 4) / 4;
+			return (const uint8_t*)patched.data();
+		});
+		// Mesh extensions refer to a FTX element (+1, 0 if none) and to an earlier DAT element
+		datPackBuf.merge(part.datPackBuf, newOffsets[DAT], [&](const PackBufferBase::Entry& entry, const uint8_t* bytes) -> const uint8_t* {
+			if (entry.kind != DAT_MESH_EXTENSION)
+				return nullptr;
+			patched.assign(bytes, bytes + entry.size);
+			uint32_t* ext1 = (uint32_t*)patched.data();
+			if (ext1[0] != 0)
+				ext1[0] = relocate(FTX, ext1[0] - 1) + 1;
+			ext1[2] = relocate(DAT, ext1[2]);
+			return patched.data();
+		});
+
+		uint32_t heabase = (uint32_t)heabuf.size();
+		heabuf.addData(part.heabuf.getPointer(), part.heabuf.size());
+		for (OffsetFixup fixup : part.heaFixups) {
+			fixup.position += heabase;
+			relocateHeaderOffset(fixup, relocate);
+			heaFixups.push_back(fixup);
+		}
+		auto moveHeaders = [heabase](Chunk& chunk, auto& rec) -> void {
+			chunk.tag += heabase;
+			for (Chunk& sub : chunk.subchunks)
+				rec(sub, rec);
+		};
+		for (Chunk& chunk : chunks)
+			moveHeaders(chunk, moveHeaders);
+		moc_objcount += part.moc_objcount;
+		numDanglingRefs += part.numDanglingRefs;
+	}
+
+	// Once every object is saved, stores the PNAM, PDBL and PDAT elements that are the end
+	// of another element at the end of it
+	void shareTails()
+	{
+		std::array<std::vector<uint32_t>, NUM_PACKS> newOffsets;
+		std::array<std::vector<uint8_t>, NUM_PACKS> newBuffers;
+		// mesh extensions are excluded, as their offsets into PDAT still have to be relocated
+		for (PackId pack : { NAM, DBL, DAT })
+			newBuffers[pack] = getPack(pack).shareTails(newOffsets[pack], [](const PackBufferBase::Entry& entry) { return entry.kind != DAT_MESH_EXTENSION; });
+		auto relocate = [&](PackId pack, uint32_t byteOffset) {
+			return PackBufferBase::relocate(getPack(pack), newOffsets[pack], byteOffset);
+		};
+		for (const OffsetFixup& fixup : heaFixups)
+			if (fixup.pack == NAM || fixup.pack == DBL || fixup.pack == DAT)
+				relocateHeaderOffset(fixup, relocate);
+		for (size_t i = 0; i < datPackBuf.entries.size(); ++i) {
+			if (datPackBuf.entries[i].kind == DAT_MESH_EXTENSION) {
+				uint32_t* ext1 = (uint32_t*)(newBuffers[DAT].data() + newOffsets[DAT][i]);
+				ext1[2] = relocate(DAT, ext1[2]);
+			}
+		}
+		// the elements are not known anymore, so nothing can be added after this
+		for (PackId pack : { NAM, DBL, DAT }) {
+			PackBufferBase& buf = getPack(pack);
+			buf.buffer = std::move(newBuffers[pack]);
+			buf.entries.clear();
+			buf.entriesByHash.clear();
+		}
+	}
+
+private:
+	template <class Relocate> void relocateHeaderOffset(const OffsetFixup& fixup, const Relocate& relocate)
+	{
+		uint32_t& value = *(uint32_t*)heabuf.getPointer(fixup.position);
+		uint32_t unit = getPack(fixup.pack).offsetUnit;
+		uint32_t byteOffset = ((value & ~fixup.flag) - fixup.bias) * unit;
+		value = (relocate(fixup.pack, byteOffset) / unit + fixup.bias) | fixup.flag;
+	}
 };
 
-Chunk Scene::ConstructSPK()
+Chunk Scene::ConstructSPK(bool parallel)
 {
-	SceneSaver saver;
 	Chunk newSpkChunk('SPK');
 	newSpkChunk.subchunks.reserve(30);
 
 	Chunk& nrot = newSpkChunk.subchunks.emplace_back('TORP');
 	Chunk& nclp = newSpkChunk.subchunks.emplace_back('PLCP');
 
+	// Object IDs, and number of objects in the subtree of each child of the roots
+	std::vector<uint32_t> objIds(objectPool.slotCount(), 0);
 	uint32_t objid = 1;
-	auto z = [&objid,&saver](GameObject *o, auto& rec) -> void {
+	auto setId = [this,&objIds](GameObject* o, uint32_t id) {
+		size_t index = objectPool.indexOf(o);
+		assert(index != SIZE_MAX);
+		objIds[index] = id;
+	};
+	auto z = [&objid,&setId](GameObject *o, auto& rec) -> void {
 		for (auto e = o->subobj.begin(); e != o->subobj.end(); e++)
 		{
-			saver.objidmap[*e] = objid++;
+			setId(*e, objid++);
 			rec(*e, rec);
 		}
 	};
-	z(cliprootobj, z);
-	z(rootobj, z);
-
-	auto f = [this,&saver](Chunk *c, GameObject *o) {
-		c->subchunks.resize(o->subobj.size());
-		saver.moc_objcount = 0;
-		int i = 0;
-		for (auto e = o->subobj.begin(); e != o->subobj.end(); e++)
-		{
-			Chunk *s = &c->subchunks[i++];
-			saver.MakeObjChunk(s, *e, o==cliprootobj);
+	auto numberChildren = [&](GameObject* root) {
+		std::vector<uint32_t> treeSizes;
+		for (GameObject* child : root->subobj) {
+			uint32_t first = objid;
+			setId(child, objid++);
+			z(child, z);
+			treeSizes.push_back(objid - first);
 		}
-		c->maindata.resize(4);
-		*(uint32_t*)c->maindata.data() = saver.moc_objcount;
+		return treeSizes;
 	};
-	f(&nrot, rootobj);
-	f(&nclp, cliprootobj);
+	std::vector<uint32_t> clpTreeSizes = numberChildren(cliprootobj);
+	std::vector<uint32_t> rotTreeSizes = numberChildren(rootobj);
+
+	SceneSaver saver(&objectPool, &objIds);
+	if (!parallel) {
+		auto f = [this,&saver](Chunk *c, GameObject *o) {
+			c->subchunks.resize(o->subobj.size());
+			saver.moc_objcount = 0;
+			int i = 0;
+			for (auto e = o->subobj.begin(); e != o->subobj.end(); e++)
+			{
+				Chunk *s = &c->subchunks[i++];
+				saver.MakeObjChunk(s, *e, o==cliprootobj);
+			}
+			c->maindata.resize(4);
+			*(uint32_t*)c->maindata.data() = saver.moc_objcount;
+		};
+		f(&nrot, rootobj);
+		f(&nclp, cliprootobj);
+	}
+	else {
+		// The children of the roots are split into groups of consecutive objects with about the same number
+		// of descendants, saved concurrently by partial savers, which are then merged in order
+		// so that the packs are identical to the serial ones.
+		struct SaveGroup {
+			GameObject* root;
+			Chunk* rootChunk;
+			size_t first, last;
+			std::unique_ptr<SceneSaver> part;
+		};
+		std::vector<SaveGroup> groups;
+		uint32_t numObjects = objid - 1;
+		uint32_t groupSize = std::max(64u, numObjects / (4 * std::max(1u, std::thread::hardware_concurrency())));
+		auto makeGroups = [&](GameObject* root, Chunk* rootChunk, const std::vector<uint32_t>& treeSizes) {
+			rootChunk->subchunks.resize(root->subobj.size());
+			size_t first = 0;
+			uint32_t size = 0;
+			for (size_t i = 0; i < treeSizes.size(); ++i) {
+				size += treeSizes[i];
+				if (size >= groupSize || i + 1 == treeSizes.size()) {
+					groups.push_back({ root, rootChunk, first, i + 1 });
+					first = i + 1;
+					size = 0;
+				}
+			}
+		};
+		makeGroups(rootobj, &nrot, rotTreeSizes);
+		makeGroups(cliprootobj, &nclp, clpTreeSizes);
+
+		ParallelFor(groups.size(), [&](size_t g) {
+			SaveGroup& group = groups[g];
+			group.part = std::make_unique<SceneSaver>(&objectPool, &objIds, true);
+			for (size_t i = group.first; i < group.last; ++i)
+				group.part->MakeObjChunk(&group.rootChunk->subchunks[i], group.root->subobj[i], group.root == cliprootobj);
+		}, 1);
+
+		for (Chunk* rootChunk : { &nrot, &nclp }) {
+			saver.moc_objcount = 0;
+			for (SaveGroup& group : groups) {
+				if (group.rootChunk != rootChunk)
+					continue;
+				saver.merge(*group.part, Span<Chunk>(rootChunk->subchunks.data() + group.first, group.last - group.first));
+				group.part.reset();
+			}
+			rootChunk->maindata.resize(4);
+			*(uint32_t*)rootChunk->maindata.data() = saver.moc_objcount;
+		}
+	}
+
+	saver.shareTails();
 
 	// Fills a chunk
 	auto fillMaindata = [](uint32_t tag, Chunk *nthg, const auto& buf) {
@@ -714,34 +1350,37 @@ Chunk Scene::ConstructSPK()
 	};
 
 	// Chunk comparison
-	auto chkcmp = [](Chunk* chka, Chunk* chkb, const char* name) {
+	auto chkcmp = [](ChunkView chka, Chunk* chkb, const char* name) {
 		printf("----- Comparison of old and new %s -----\n", name);
-		if (chka->tag != chkb->tag)
+		ByteSpan mainA = chka.maindata();
+		if (chka.tag() != chkb->tag)
 			printf("Different tag\n");
-		if (chka->multidata.size() != chkb->multidata.size())
-			printf("Different num_datas: %zu -> %zu\n", chka->multidata.size(), chkb->multidata.size());
-		if (chka->maindata.size() != chkb->maindata.size())
-			printf("Different maindata_size: %zu -> %zu\n", chka->maindata.size(), chkb->maindata.size());
-		else if(chka->maindata.size()) {
+		if (chka.numMultidata() != chkb->multidata.size())
+			printf("Different num_datas: %u -> %zu\n", chka.numMultidata(), chkb->multidata.size());
+		if (mainA.size() != chkb->maindata.size())
+			printf("Different maindata_size: %zu -> %zu\n", mainA.size(), chkb->maindata.size());
+		else if(mainA.size()) {
 			uint32_t mdcmp = 0;
-			for (size_t i = 0; i < (size_t)chka->maindata.size(); i++)
-				if (((char*)chka->maindata.data())[i] != ((char*)chkb->maindata.data())[i])
+			for (size_t i = 0; i < mainA.size(); i++)
+				if (mainA[i] != chkb->maindata[i])
 					mdcmp += 1;
 			if (mdcmp != 0)
 				printf("Different maindata content: %u bytes are different\n", mdcmp);
-			auto sum_a = ComputeBytesum(chka->maindata.data(), chka->maindata.size());
+			auto sum_a = ComputeBytesum(mainA.data(), mainA.size());
 			auto sum_b = ComputeBytesum(chkb->maindata.data(), chkb->maindata.size());
 			if (sum_a != sum_b)
 				printf("Different bytesum\n");
 			else
 				printf("Same bytesum\n");
 		}
-		else if (chka->multidata.size()) {
-			int numSizeDiff = 0, numContentDiff = 0, numSame = 0, numTotal = (int)chka->multidata.size();
-			for (size_t i = 0; i < chka->multidata.size(); ++i) {
-				if (chka->multidata[i].size() != chkb->multidata[i].size())
+		else if (chka.numMultidata() && chka.numMultidata() == chkb->multidata.size()) {
+			int numSizeDiff = 0, numContentDiff = 0, numSame = 0, numTotal = (int)chka.numMultidata();
+			size_t i = 0;
+			for (ByteSpan datA : chka.multidata()) {
+				const Chunk::DataBuffer& datB = chkb->multidata[i++];
+				if (datA.size() != datB.size())
 					numSizeDiff += 1;
-				else if (memcmp(chka->multidata[i].data(), chkb->multidata[i].data(), chka->multidata[i].size()))
+				else if (memcmp(datA.data(), datB.data(), datA.size()))
 					numContentDiff += 1;
 				else
 					numSame += 1;
@@ -782,6 +1421,10 @@ Chunk Scene::ConstructSPK()
 	Chunk& zdefNew = newSpkChunk.subchunks.emplace_back('FEDZ');
 	zdefNew.multidata.resize(3);
 	auto strValues = zdefValues.save(saver);
+	if (saver.numDanglingRefs) {
+		std::string msg = std::to_string(saver.numDanglingRefs) + " reference(s) to deleted objects or objects outside of the scene were saved as null references.";
+		warn(msg.c_str());
+	}
 	zdefNew.multidata[0].resize(zdefNames.size() + 1);
 	zdefNew.multidata[1].resize(strValues.size());
 	zdefNew.multidata[2].resize(zdefTypes.size() + 1);
@@ -842,8 +1485,9 @@ Chunk Scene::ConstructSPK()
 		newSpkChunk.subchunks.push_back(rem);
 
 	// Chunk Comparisons
+	ChunkView oldSpkChunk = (!spkData || spkData->empty()) ? ChunkView() : ChunkView(spkData->data());
 	for (Chunk& nchunk : newSpkChunk.subchunks) {
-		Chunk* ochunk = oldSpkChunk.findSubchunk(nchunk.tag);
+		ChunkView ochunk = oldSpkChunk.findSubchunk(nchunk.tag);
 		char name[5];
 		*(uint32_t*)name = nchunk.tag;
 		name[4] = 0;
@@ -858,6 +1502,45 @@ Chunk Scene::ConstructSPK()
 	return newSpkChunk;
 }
 
+// File data compressed with raw deflate, with the information ZIP needs about the original data
+struct DeflatedZipEntry {
+	std::vector<uint8_t> compressed;
+	size_t uncompressedSize = 0;
+	mz_uint32 crc32 = 0;
+	bool stored = false; // compression didn't help, so compressed contains the original data
+};
+
+// Compresses the same way as mz_zip_writer_add_mem with MZ_DEFAULT_COMPRESSION,
+// but can be done on any thread.
+static DeflatedZipEntry DeflateZipEntry(std::string_view data)
+{
+	DeflatedZipEntry entry;
+	entry.uncompressedSize = data.size();
+	entry.crc32 = (mz_uint32)mz_crc32(MZ_CRC32_INIT, (const unsigned char*)data.data(), data.size());
+	int flags = (int)tdefl_create_comp_flags_from_zip_params(MZ_DEFAULT_LEVEL, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+	auto putBuf = [](const void* buf, int len, void* user) -> mz_bool {
+		auto* out = (std::vector<uint8_t>*)user;
+		out->insert(out->end(), (const uint8_t*)buf, (const uint8_t*)buf + len);
+		return MZ_TRUE;
+	};
+	entry.compressed.reserve(data.size() / 2);
+	bool ok = data.size() > 3 && tdefl_compress_mem_to_output(data.data(), data.size(), putBuf, &entry.compressed, flags);
+	if (!ok || entry.compressed.size() >= data.size()) {
+		entry.compressed.assign(data.begin(), data.end());
+		entry.stored = true;
+	}
+	return entry;
+}
+
+static void AddDeflatedZipEntry(mz_zip_archive* zip, const char* filename, const DeflatedZipEntry& entry)
+{
+	if (entry.stored)
+		mz_zip_writer_add_mem(zip, filename, entry.compressed.data(), entry.compressed.size(), MZ_NO_COMPRESSION);
+	else
+		mz_zip_writer_add_mem_ex(zip, filename, entry.compressed.data(), entry.compressed.size(), nullptr, 0,
+			MZ_DEFAULT_LEVEL | MZ_ZIP_FLAG_COMPRESSED_DATA, entry.uncompressedSize, entry.crc32);
+}
+
 void Scene::SaveSceneSPK(const char *fn)
 {
 	mz_zip_archive outzip;
@@ -866,7 +1549,26 @@ void Scene::SaveSceneSPK(const char *fn)
 	mzr = mz_zip_writer_init_file(&outzip, fn, 0);
 	if (!mzr) { warn("Couldn't create the new scene ZIP file for saving."); return; }
 
-	if (!zipmem.empty()) {
+	// Packs that weren't modified since loading are copied compressed as they are from the original ZIP,
+	// the others are serialized and deflated concurrently, and then added to the ZIP in a fixed order
+	struct PackToSave {
+		const char* ext;
+		const Chunk* chunk;
+		bool serialize;
+		std::shared_ptr<RepeatIndex> repeat; // attached when the pack was loaded from a PackRepeat
+		std::future<DeflatedZipEntry> entry;
+		bool asRepeat = false;
+	};
+	bool hasOriginal = !zipmem.empty();
+	PackToSave packs[] = {
+		{ "PAL", &palPack, !hasOriginal || dirtyPacks.pal, repeatIndices.pal },
+		{ "DXT", &dxtPack, !hasOriginal || dirtyPacks.dxt, repeatIndices.dxt },
+		{ "LGT", &lgtPack, !hasOriginal || dirtyPacks.lgt, repeatIndices.lgt },
+		{ "WAV", &wavPack, !hasOriginal || dirtyPacks.wav, repeatIndices.wav },
+		{ "ANM", &anmPack, hasAnmPack && (!hasOriginal || dirtyPacks.anm) },
+	};
+
+	if (hasOriginal) {
 		mz_zip_archive inzip;
 		mz_zip_zero_struct(&inzip);
 		mzr = mz_zip_reader_init_mem(&inzip, zipmem.data(), zipmem.size(), 0);
@@ -874,13 +1576,18 @@ void Scene::SaveSceneSPK(const char *fn)
 
 		int nfiles = mz_zip_reader_get_num_files(&inzip);
 		// Determine files to copy from original ZIP
-		static constexpr const char* nocopyFiles[] = { "Pack.SPK", "Pack.PAL", "Pack.DXT", "Pack.ANM", "Pack.WAV", "Pack.LGT",
-			"PackRepeat.PAL", "PackRepeat.DXT", "PackRepeat.ANM", "PackRepeat.WAV" };
 		std::vector<bool> allowCopy = std::vector<bool>(nfiles, true);
-		for (size_t i = 0; i < std::size(nocopyFiles); ++i) {
-			int x = mz_zip_reader_locate_file(&inzip, nocopyFiles[i], nullptr, 0);
+		auto disallow = [&](const std::string& filename) {
+			int x = mz_zip_reader_locate_file(&inzip, filename.c_str(), nullptr, 0);
 			if (x != -1)
 				allowCopy[x] = false;
+		};
+		disallow("Pack.SPK");
+		for (const PackToSave& pack : packs) {
+			if (pack.serialize) {
+				disallow(std::string("Pack.") + pack.ext);
+				disallow(std::string("PackRepeat.") + pack.ext);
+			}
 		}
 		// Copy the files
 		for (int i = 0; i < nfiles; i++)
@@ -889,19 +1596,38 @@ void Scene::SaveSceneSPK(const char *fn)
 		mz_zip_reader_end(&inzip);
 	}
 
-	auto saveChunk = [&outzip](Chunk* chk, const char* filename) {
-		auto str = chk->saveToString();
-		mz_zip_writer_add_mem(&outzip, filename, str.data(), str.size(), MZ_DEFAULT_COMPRESSION);
+	// Packs whose data can all be found in the game's Repeat file are saved as PackRepeat.
+	// The Repeat file is only looked up again for packs that weren't loaded from one.
+	auto deflatePack = [](const Chunk* chk, const char* ext, std::shared_ptr<RepeatIndex> repeat, bool* outRepeat) {
+		std::string packRepeat;
+		if (!repeat)
+			repeat = RepeatIndex::forFile(std::string("Repeat.") + ext);
+		*outRepeat = repeat && repeat->makePackRepeat(*chk, packRepeat);
+		return DeflateZipEntry(*outRepeat ? packRepeat : chk->saveToString());
 	};
-	Chunk spkchk = ConstructSPK();
-	saveChunk(&spkchk, "Pack.SPK");
-	oldSpkChunk = std::move(spkchk);
-	saveChunk(&palPack, "Pack.PAL");
-	saveChunk(&dxtPack, "Pack.DXT");
-	saveChunk(&lgtPack, "Pack.LGT");
-	saveChunk(&wavPack, "Pack.WAV");
-	if (hasAnmPack)
-		saveChunk(&anmPack, "Pack.ANM");
+	for (PackToSave& pack : packs)
+		if (pack.serialize)
+			pack.entry = std::async(std::launch::async, deflatePack, pack.chunk, pack.ext, pack.repeat, &pack.asRepeat);
+
+	// the SPK is serialized directly into a new spkData, which is kept for the next save
+	// (the previous one stays alive as long as meshes refer to it)
+	Chunk spkchk = ConstructSPK(std::thread::hardware_concurrency() > 1);
+	auto newSpkData = std::make_shared<std::vector<uint8_t>>(spkchk.serializedSize());
+	uint8_t* spkOut = newSpkData->data();
+	spkchk.save([&spkOut](const void* data, size_t length) {
+		memcpy(spkOut, data, length);
+		spkOut += length;
+	});
+	spkData = std::move(newSpkData);
+	DeflatedZipEntry spkEntry = DeflateZipEntry(std::string_view((const char*)spkData->data(), spkData->size()));
+
+	AddDeflatedZipEntry(&outzip, "Pack.SPK", spkEntry);
+	for (PackToSave& pack : packs) {
+		if (pack.serialize) {
+			DeflatedZipEntry entry = pack.entry.get();
+			AddDeflatedZipEntry(&outzip, (std::string(pack.asRepeat ? "PackRepeat." : "Pack.") + pack.ext).c_str(), entry);
+		}
+	}
 
 	mz_zip_writer_finalize_archive(&outzip);
 	mz_zip_writer_end(&outzip);
@@ -909,17 +1635,31 @@ void Scene::SaveSceneSPK(const char *fn)
 
 void Scene::Close()
 {
-	if (!ready)
-		return;
-	auto destroyObj = [](GameObject* obj, const auto& rec) -> void {
-		for (GameObject* sub : obj->subobj)
-			rec(sub, rec);
-		delete obj;
-	};
-	if (superroot)
-		destroyObj(superroot, destroyObj);
+	if (ready)
+		*this = Scene(); // move a default-constructed scene
+}
+
+Scene& Scene::operator=(Scene&& other)
+{
+	if (this != &other) {
+		this->~Scene();
+		new (this) Scene(std::move(other));
+	}
+	return *this;
+}
+
+void Scene::release()
+{
 	ready = false;
-	*this = {}; // move a default-constructed scene
+	std::unique_ptr<Arena> arena = std::move(bufferArena);
+	{
+		// destroy the objects, components and chunks while the arena is still there,
+		// the object pool is freed slab by slab without walking the hierarchy
+		Scene released = std::move(*this);
+	}
+	// nothing allocated from the arena may outlive the scene
+	assert(!arena || arena->getNumLiveAllocations() == 0);
+	arena.reset();
 
 	// clean ref counts
 	for (auto it = g_objRefCounts.begin(); it != g_objRefCounts.end();) {
@@ -939,14 +1679,14 @@ void Scene::RemoveObject(GameObject *o)
 		assert(it != o->parent->subobj.end());
 		o->parent->subobj.erase(it);
 	}
-	delete o;
+	deleteObject(o);
 }
 
 GameObject* Scene::DuplicateObject(GameObject *o, GameObject *parent)
 {
 	if (!parent) parent = rootobj;
 	if (!o->parent) return 0;
-	GameObject *d = new GameObject(*o);
+	GameObject *d = newObject(*o);
 	
 	//d->refcount = 0;
 	d->subobj.clear();
@@ -971,20 +1711,179 @@ void Scene::GiveObject(GameObject *o, GameObject *t)
 	o->parent = t;
 }
 
+uint32_t DBLList::addBytes(const void* data, size_t size)
+{
+	uint32_t offset = (uint32_t)bytes.size();
+	bytes.insert(bytes.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+	return offset;
+}
+
+uint32_t DBLList::addString(std::string_view str)
+{
+	return addData(str.data(), str.size(), 1);
+}
+
+uint32_t DBLList::addData(const void* data, size_t size, size_t padding)
+{
+	// The value can come from the list itself (e.g. a view from getString),
+	// so find it again after growing bytes, which can reallocate it.
+	const uint8_t* src = (const uint8_t*)data;
+	bool fromBytes = size && src >= bytes.data() && src < bytes.data() + bytes.size();
+	size_t srcOffset = fromBytes ? src - bytes.data() : 0;
+	uint32_t offset = (uint32_t)bytes.size();
+	bytes.resize(offset + 4 + size + padding);
+	if (fromBytes)
+		src = bytes.data() + srcOffset;
+	uint32_t size32 = (uint32_t)size;
+	memcpy(bytes.data() + offset, &size32, 4);
+	memcpy(bytes.data() + offset + 4, src, size);
+	return offset;
+}
+
+uint32_t DBLList::storedSize(const DBLEntry& e) const
+{
+	using ET = DBLEntry::EType;
+	if (inSource(e))
+		return 0;
+	switch (e.type) {
+	case ET::DOUBLE:
+	case ET::ZGEOMREFTAB:
+		return 8;
+	case ET::STRING:
+	case ET::FILE:
+		return 4 + readBytes<uint32_t>(e.payload) + 1;
+	case ET::DATA:
+		return 4 + readBytes<uint32_t>(e.payload);
+	default:
+		return 0;
+	}
+}
+
+void DBLList::replaced(const DBLEntry& e, uint32_t newOffset)
+{
+	unusedBytes += storedSize(e);
+	const_cast<DBLEntry&>(e).payload = newOffset;
+	if (unusedBytes >= 1024 && unusedBytes > bytes.size() / 2)
+		compact();
+}
+
+void DBLList::compact()
+{
+	std::vector<uint8_t> newBytes;
+	newBytes.reserve(bytes.size() - unusedBytes);
+	for (DBLEntry& e : entries) {
+		if (uint32_t size = storedSize(e)) {
+			uint32_t offset = (uint32_t)newBytes.size();
+			newBytes.insert(newBytes.end(), bytes.begin() + e.payload, bytes.begin() + e.payload + size);
+			e.payload = offset;
+		}
+	}
+	bytes = std::move(newBytes);
+	unusedBytes = 0;
+}
+
+double DBLList::getDouble(const DBLEntry& e) const
+{
+	if (inSource(e)) {
+		double value;
+		memcpy(&value, sourceValue(e), 8);
+		return value;
+	}
+	return readBytes<double>(e.payload);
+}
+
+void DBLList::setDouble(DBLEntry& e, double value)
+{
+	if (inSource(e))
+		e.payload = addBytes(&value, 8);
+	else
+		memcpy(bytes.data() + e.payload, &value, 8);
+}
+
+std::string_view DBLList::getString(const DBLEntry& e) const
+{
+	if (inSource(e))
+		return std::string_view((const char*)sourceValue(e));
+	return std::string_view((const char*)bytes.data() + e.payload + 4, readBytes<uint32_t>(e.payload));
+}
+
+void DBLList::setString(DBLEntry& e, std::string_view value)
+{
+	if (value == getString(e))
+		return;
+	replaced(e, addString(value));
+}
+
+Span<const uint8_t> DBLList::getData(const DBLEntry& e) const
+{
+	if (inSource(e)) {
+		// stored with the size of the whole element, including the size itself
+		const uint8_t* value = sourceValue(e);
+		return Span<const uint8_t>(value + 4, *(const uint32_t*)value - 4);
+	}
+	return Span<const uint8_t>(bytes.data() + e.payload + 4, readBytes<uint32_t>(e.payload));
+}
+
+void DBLList::setData(DBLEntry& e, const void* data, size_t size)
+{
+	replaced(e, addData(data, size));
+}
+
+Span<GORef> DBLList::getRefTable(const DBLEntry& e)
+{
+	return Span<GORef>(refs.data() + readBytes<uint32_t>(e.payload), readBytes<uint32_t>(e.payload + 4));
+}
+
+DBLEntry& DBLList::addEntry(DBLEntry::EType type, uint8_t flags)
+{
+	using ET = DBLEntry::EType;
+	DBLEntry& e = entries.emplace_back();
+	e.type = type;
+	e.flags = flags;
+	switch (type) {
+	case ET::DOUBLE: {
+		double zero = 0.0;
+		e.payload = addBytes(&zero, 8);
+		break;
+	}
+	case ET::STRING:
+	case ET::FILE:
+		e.payload = addString({});
+		break;
+	case ET::DATA:
+		e.payload = addData(nullptr, 0);
+		break;
+	case ET::ZGEOMREF:
+		e.payload = (uint32_t)refs.size();
+		refs.emplace_back();
+		break;
+	case ET::ZGEOMREFTAB: {
+		uint32_t table[2] = { (uint32_t)refs.size(), 0 };
+		e.payload = addBytes(table, 8);
+		break;
+	}
+	case ET::SCRIPT:
+		e.payload = (uint32_t)scripts.size();
+		scripts.emplace_back();
+		break;
+	default:
+		break;
+	}
+	return e;
+}
+
 void DBLList::addMembers(const std::vector<ClassInfo::ObjectMember>& members)
 {
 	using ET = DBLEntry::EType;
 	for (auto& mem : members) {
 		auto& cm = mem.info;
 		auto& defValue = cm->defaultValue;
-		DBLEntry& de = entries.emplace_back();
 		if (cm->type == "DOUBLE") {
-			de.type = ET::DOUBLE;
-			de.value.emplace<double>(defValue.empty() ? 0.0f : std::stod(defValue));
+			DBLEntry& de = addEntry(ET::DOUBLE);
+			setDouble(de, defValue.empty() ? 0.0f : std::stod(defValue));
 		}
 		else if (cm->type == "FLOAT") {
-			de.type = ET::FLOAT;
-			de.value.emplace<float>(defValue.empty() ? 0.0f : std::stof(defValue));
+			addEntry(ET::FLOAT).setFloat(defValue.empty() ? 0.0f : std::stof(defValue));
 		}
 		else if (cm->type == "INT" || cm->type == "LONG" || cm->type == "BOOL" || cm->type == "COLOR") {
 			uint32_t value;
@@ -994,49 +1893,42 @@ void DBLList::addMembers(const std::vector<ClassInfo::ObjectMember>& members)
 				value = 1;
 			else
 				value = std::stoi(defValue);
-			de.type = ET::INT;
-			de.value.emplace<uint32_t>(value);
+			addEntry(ET::INT).payload = value;
 		}
 		else if (cm->type == "ENUM") {
-			de.type = ET::INT;
-			de.value.emplace<uint32_t>(0);
+			addEntry(ET::INT);
 		}
 		else if (cm->type == "WINOBJTYPE") {
-			de.type = ET::INT;
-			de.value.emplace<uint32_t>(0);
+			addEntry(ET::INT);
 		}
 		else if (cm->type == "CHAR*" || cm->type == "SUBPIC") {
+			DBLEntry& de = entries.emplace_back();
 			de.type = ET::STRING;
-			de.value.emplace<std::string>(defValue);
+			de.payload = addString(defValue);
 		}
 		else if (cm->type == "DATA" || cm->type == "TABLE") {
-			de.type = ET::DATA;
-			de.value.emplace<std::vector<uint8_t>>();
+			addEntry(ET::DATA);
 		}
 		else if (cm->type == "ZGEOMREF") {
-			de.type = ET::ZGEOMREF;
-			de.value.emplace<GORef>();
+			addEntry(ET::ZGEOMREF);
 		}
 		else if (cm->type == "ZGEOMREFTAB") {
-			de.type = ET::ZGEOMREFTAB;
-			de.value.emplace<std::vector<GORef>>();
+			addEntry(ET::ZGEOMREFTAB);
 		}
 		else if (cm->type == "MSG") {
-			de.type = ET::MSG;
-			de.value.emplace<uint32_t>(0);
+			addEntry(ET::MSG);
 		}
 		else if (cm->type == "SNDREF" || cm->type == "SNDSETREF") {
-			de.type = ET::SNDREF;
-			de.value.emplace<AudioRef>();
+			addEntry(ET::SNDREF);
 		}
 		else if (cm->type == "SCRIPT") {
-			de.type = ET::SCRIPT;
-			de.value.emplace<DBLList>();
+			addEntry(ET::SCRIPT);
 		}
 		else if (cm->type == "") {
-			de.type = ET::TERMINATOR;
+			addEntry(ET::TERMINATOR);
 		}
 		else {
+			addEntry(ET::UNDEFINED);
 			printf("What is %s?\n", cm->type.c_str());
 		}
 	}
@@ -1044,7 +1936,7 @@ void DBLList::addMembers(const std::vector<ClassInfo::ObjectMember>& members)
 
 GameObject* Scene::CreateObject(int type, GameObject* parent)
 {
-	GameObject* obj = new GameObject();
+	GameObject* obj = newObject();
 	obj->type = type;
 	obj->flags = ClassInfo::GetObjTypeCategory(type);
 	
@@ -1053,14 +1945,14 @@ GameObject* Scene::CreateObject(int type, GameObject* parent)
 	obj->root = parent->root;
 
 	if (obj->flags & 0x0020)
-		obj->mesh = std::make_shared<Mesh>();
+		obj->mesh = newComponent<Mesh>();
 	if (obj->flags & 0x0080)
-		obj->light = std::make_shared<Light>();
+		obj->light = newComponent<Light>();
 	if (obj->flags & 0x0400)
-		obj->line = std::make_shared<ObjLine>();
+		obj->line = newComponent<ObjLine>();
 
 	auto members = ClassInfo::GetMemberNames(obj);
-	obj->dbl.addMembers(members);
+	obj->dbl.addMembers(*members);
 	return obj;
 }
 
@@ -1075,19 +1967,28 @@ const char * DBLEntry::getTypeName(int type)
 	return "?";
 }
 
-void DBLList::load(uint8_t* dpbeg, const std::map<uint32_t, GameObject*>& idobjmap)
+void DBLList::load(const uint8_t* dpbeg, const std::vector<GameObject*>& idobjs, std::atomic<uint32_t>* refCounts,
+	const std::shared_ptr<const void>& sourceKeeper)
 {
 	using ET = DBLEntry::EType;
-	auto decodeRef = [&idobjmap](uint32_t id) -> GameObject* {
-		if (id != 0)
-			return idobjmap.at(id);
-		else
-			return nullptr;
+	auto decodeRef = [&idobjs, refCounts](uint32_t id) -> GORef {
+		GameObject* obj = idobjs.at(id); // idobjs[0] is null
+		if (!refCounts)
+			return GORef(obj);
+		if (obj)
+			refCounts[id].fetch_add(1, std::memory_order_relaxed);
+		return GORef(obj, GORef::Uncounted());
 	};
 
-	uint32_t ds = *(uint32_t*)dpbeg & 0xFFFFFF;
-	flags = (*(uint32_t*)dpbeg >> 24) & 255;
-	uint8_t* dp = dpbeg + 4;
+	uint32_t ds = *(const uint32_t*)dpbeg & 0xFFFFFF;
+	flags = (*(const uint32_t*)dpbeg >> 24) & 255;
+	if (sourceKeeper) {
+		source = dpbeg;
+		this->sourceKeeper = sourceKeeper;
+	}
+	else
+		bytes.reserve(ds);
+	const uint8_t* dp = dpbeg + 4;
 	while (dp - dpbeg < ds)
 	{
 		if (*dp == 0xFF) {
@@ -1103,63 +2004,60 @@ void DBLList::load(uint8_t* dpbeg, const std::map<uint32_t, GameObject*>& idobjm
 		case ET::UNDEFINED:
 			break;
 		case ET::DOUBLE:
-			e.value = *(double*)dp;
+			e.payload = source ? (uint32_t)(dp - source) | SOURCE_VALUE : addBytes(dp, 8);
 			dp += 8;
 			break;
 		case ET::FLOAT:
-			e.value = *(float*)dp;
-			dp += 4;
-			break;
 		case ET::INT:
 		case ET::MSG:
-			e.value = *(uint32_t*)dp;
+		case ET::SNDREF:
+			e.payload = *(const uint32_t*)dp;
 			dp += 4;
 			break;
 		case ET::STRING:
-		case ET::FILE:
-			e.value.emplace<std::string>((const char*)dp);
-			while (*(dp++));
+		case ET::FILE: {
+			std::string_view str((const char*)dp);
+			e.payload = source ? (uint32_t)(dp - source) | SOURCE_VALUE : addString(str);
+			dp += str.size() + 1;
 			break;
+		}
 		case ET::TERMINATOR:
 			break;
 		case ET::DATA: {
-			auto datsize = *(uint32_t*)dp - 4;
-			e.value.emplace<std::vector<uint8_t>>(dp + 4, dp + 4 + datsize);
-			dp += *(uint32_t*)dp;
+			auto datsize = *(const uint32_t*)dp - 4;
+			e.payload = source ? (uint32_t)(dp - source) | SOURCE_VALUE : addData(dp + 4, datsize);
+			dp += *(const uint32_t*)dp;
 			break;
 		}
 		case ET::ZGEOMREF:
-			e.value.emplace<GORef>(decodeRef(*(uint32_t*)dp));
+			e.payload = (uint32_t)refs.size();
+			refs.push_back(decodeRef(*(const uint32_t*)dp));
 			dp += 4;
 			break;
 		case ET::ZGEOMREFTAB: {
-			uint32_t nobjs = (*(uint32_t*)dp - 4) / 4;
-			std::vector<GORef>& objlist = e.value.emplace<std::vector<GORef>>();
+			uint32_t nobjs = (*(const uint32_t*)dp - 4) / 4;
+			uint32_t table[2] = { (uint32_t)refs.size(), nobjs };
+			e.payload = addBytes(table, 8);
 			for (uint32_t i = 0; i < nobjs; i++)
-				objlist.emplace_back(decodeRef(*(uint32_t*)(dp + 4 + 4 * i)));
-			dp += *(uint32_t*)dp;
-			break;
-		}
-		case ET::SNDREF: {
-			AudioRef& aoref = e.value.emplace<AudioRef>();
-			aoref.id = *(uint32_t*)dp;
-			dp += 4;
+				refs.push_back(decodeRef(*(const uint32_t*)(dp + 4 + 4 * i)));
+			dp += *(const uint32_t*)dp;
 			break;
 		}
 		case ET::SCRIPT: {
-			DBLList& sublist = e.value.emplace<DBLList>();
-			uint32_t dblsize = *(uint32_t*)dp;
-			sublist.load(dp, idobjmap);
+			e.payload = (uint32_t)scripts.size();
+			DBLList& sublist = scripts.emplace_back();
+			uint32_t dblsize = *(const uint32_t*)dp;
+			sublist.load(dp, idobjs, refCounts, sourceKeeper);
 			dp += dblsize;
 			break;
 		}
 		default:
-			ferr("Unknown DBL entry type!");
+			throw c47editException("Unknown DBL entry type!");
 		}
 	}
 }
 
-std::string DBLList::save(SceneSaver& sceneSaver)
+std::string DBLList::save(SceneSaver& sceneSaver, std::vector<std::pair<uint32_t, GameObject*>>* refPositions) const
 {
 	using ET = DBLEntry::EType;
 	ByteWriter<std::string> dblsav;
@@ -1173,47 +2071,63 @@ std::string DBLList::save(SceneSaver& sceneSaver)
 		case ET::UNDEFINED:
 			break;
 		case ET::DOUBLE:
-			dblsav.addDouble(std::get<double>(e->value)); break;
+			dblsav.addDouble(getDouble(*e)); break;
 		case ET::FLOAT:
-			dblsav.addFloat(std::get<float>(e->value)); break;
 		case ET::INT:
 		case ET::MSG:
-			dblsav.addU32(std::get<uint32_t>(e->value)); break;
+		case ET::SNDREF:
+			dblsav.addU32(e->payload); break;
 		case ET::STRING:
-		case ET::FILE:
-			dblsav.addStringNT(std::get<std::string>(e->value)); break;
+		case ET::FILE: {
+			// the stored strings are followed by their null character
+			std::string_view str = getString(*e);
+			dblsav.addData(str.data(), str.size() + 1);
+			break;
+		}
 		case ET::TERMINATOR:
 			break;
 		case ET::DATA:
 		{
-			auto& vec = std::get<std::vector<uint8_t>>(e->value);
-			dblsav.addU32((uint32_t)vec.size() + 4);
-			dblsav.addData(vec.data(), vec.size());
+			if (inSource(*e)) {
+				// copied as is, with its size
+				const uint8_t* value = sourceValue(*e);
+				dblsav.addData(value, *(const uint32_t*)value);
+				break;
+			}
+			auto data = getData(*e);
+			dblsav.addU32((uint32_t)data.size() + 4);
+			dblsav.addData(data.data(), data.size());
 			break;
 		}
 		case ET::ZGEOMREF:
 		{
-			auto& obj = std::get<GORef>(e->value);
-			uint32_t x = sceneSaver.objidmap[obj.get()];
+			auto& obj = getRef(*e);
+			if (refPositions)
+				refPositions->emplace_back((uint32_t)dblsav.size(), obj.get());
+			uint32_t x = sceneSaver.getObjId(obj.get());
 			dblsav.addU32(x); break;
 		}
 		case ET::ZGEOMREFTAB:
 		{
-			auto& vec = std::get<std::vector<GORef>>(e->value);
+			auto vec = getRefTable(*e);
 			uint32_t siz = (uint32_t)vec.size() * 4 + 4;
 			dblsav.addU32(siz);
 			for (auto& obj : vec) {
-				uint32_t x = sceneSaver.objidmap[obj.get()];
+				if (refPositions)
+					refPositions->emplace_back((uint32_t)dblsav.size(), obj.get());
+				uint32_t x = sceneSaver.getObjId(obj.get());
 				dblsav.addU32(x);
 			}
 			break;
 		}
-		case ET::SNDREF:
-			dblsav.addU32(std::get<AudioRef>(e->value).id); break;
 		case ET::SCRIPT:
 		{
-			auto& sublist = std::get<DBLList>(e->value);
-			auto subdblsav = sublist.save(sceneSaver);
+			auto& sublist = getScript(*e);
+			size_t firstSubRef = refPositions ? refPositions->size() : 0;
+			auto subdblsav = sublist.save(sceneSaver, refPositions);
+			if (refPositions)
+				for (size_t i = firstSubRef; i < refPositions->size(); ++i)
+					(*refPositions)[i].first += (uint32_t)dblsav.size();
 			dblsav.addData(subdblsav.data(), subdblsav.size());
 			break;
 		}
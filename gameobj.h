@@ -6,14 +6,20 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <cstdint>
+#include <cstring>
+#include <exception>
 #include <map>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
-#include <variant>
 #include <vector>
 
+#include "Arena.h"
+#include "LazyArray.h"
+#include "SlabPool.h"
 #include "chunk.h"
 #include "vecmat.h"
 #include "AudioManager.h"
@@ -21,6 +27,7 @@
 struct GameObject;
 struct Chunk;
 struct Scene;
+class RepeatIndex;
 
 namespace ClassInfo {
 	struct ObjectMember;
@@ -48,20 +55,24 @@ public:
 	GORef(const GORef& ref) noexcept { set(ref.m_obj); }
 	GORef(GORef&& ref) noexcept { m_obj = ref.m_obj; ref.m_obj = nullptr; }
 	GORef(GameObject* obj) noexcept { set(obj); }
+	// Reference not counted in g_objRefCounts, the caller has to add it there itself
+	struct Uncounted {};
+	GORef(GameObject* obj, Uncounted) noexcept : m_obj(obj) {}
 	~GORef() noexcept { deref(); }
 };
 
 struct Mesh
 {
-	std::vector<float> vertices;
-	std::vector<uint16_t> quadindices, triindices;
+	// Loaded meshes refer to their geometry in the SPK, it is only copied when modified
+	LazyArray<float> vertices;
+	LazyArray<uint16_t> quadindices, triindices;
 	uint32_t weird = 0;
 
 	// FTX
 	using FTXFace = std::array<uint16_t, 6>;
-	std::vector<float> textureCoords;
-	std::vector<float> lightCoords;
-	std::vector<FTXFace> ftxFaces;
+	LazyArray<float> textureCoords;
+	LazyArray<float> lightCoords;
+	LazyArray<FTXFace> ftxFaces;
 
 	struct Extension {
 		uint32_t extUnk2;
@@ -89,21 +100,13 @@ struct Light
 	uint32_t param[7];
 };
 
-struct DBLEntry;
 struct SceneSaver;
 
-struct DBLList {
-	int flags = 0;
-	std::vector<DBLEntry> entries;
-
-	void load(uint8_t* ptr, const std::map<uint32_t, GameObject*>& idobjmap);
-	std::string save(SceneSaver& sceneSaver);
-	void addMembers(const std::vector<ClassInfo::ObjectMember>& members);
-};
-
+// Entry of a DBL list. The values that fit in 32 bits (FLOAT, INT, MSG, SNDREF) are stored
+// in the entry itself, the others in the storage of the list, accessed through DBLList.
 struct DBLEntry
 {
-	enum class EType : int {
+	enum class EType : uint8_t {
 		UNDEFINED = 0,
 		DOUBLE = 1,
 		FLOAT = 2,
@@ -120,13 +123,78 @@ struct DBLEntry
 	};
 
 	EType type = EType::UNDEFINED;
-	int flags = 0;
-	using VariantType = std::variant<std::monostate, double, float, uint32_t, std::string, std::vector<uint8_t>, GORef, std::vector<GORef>, DBLList, AudioRef>;
-	VariantType value;
+	uint8_t flags = 0;
+	// INT/MSG value, SNDREF audio ID, FLOAT bits, or location of the value in the list's storage
+	// (or in the loaded PDBL, for values not modified since loading)
+	uint32_t payload = 0;
+
+	float getFloat() const { float value; memcpy(&value, &payload, 4); return value; }
+	void setFloat(float value) { memcpy(&payload, &value, 4); }
 
 	static const char* getTypeName(int type);
 };
 
+struct DBLList {
+	int flags = 0;
+	std::vector<DBLEntry> entries;
+
+	// Access to the values stored in the list, for its entries of the corresponding type.
+	// Setting a value invalidates the views previously returned by the getters.
+	double getDouble(const DBLEntry& e) const;
+	void setDouble(DBLEntry& e, double value);
+	// The string is followed by a null character
+	std::string_view getString(const DBLEntry& e) const;
+	void setString(DBLEntry& e, std::string_view value);
+	Span<const uint8_t> getData(const DBLEntry& e) const;
+	void setData(DBLEntry& e, const void* data, size_t size);
+	GORef& getRef(const DBLEntry& e) { return refs[e.payload]; }
+	const GORef& getRef(const DBLEntry& e) const { return refs[e.payload]; }
+	Span<GORef> getRefTable(const DBLEntry& e);
+	Span<const GORef> getRefTable(const DBLEntry& e) const { return const_cast<DBLList*>(this)->getRefTable(e); }
+	DBLList& getScript(const DBLEntry& e) { return scripts[e.payload]; }
+	const DBLList& getScript(const DBLEntry& e) const { return scripts[e.payload]; }
+
+	// Adds an entry with an empty value (0, "", no object, ...)
+	DBLEntry& addEntry(DBLEntry::EType type, uint8_t flags = 0);
+
+	// If refCounts is given, the object references are not counted in g_objRefCounts
+	// but in refCounts[id] instead, allowing to load several lists in parallel.
+	// If sourceKeeper is given, it keeps the buffer at ptr alive, and the doubles, strings and data
+	// are read from there instead of being copied, until they are set.
+	void load(const uint8_t* ptr, const std::vector<GameObject*>& idobjs, std::atomic<uint32_t>* refCounts = nullptr,
+		const std::shared_ptr<const void>& sourceKeeper = nullptr);
+	// If refPositions is given, it receives the offset of every object ID in the returned string
+	std::string save(SceneSaver& sceneSaver, std::vector<std::pair<uint32_t, GameObject*>>* refPositions = nullptr) const;
+	void addMembers(const std::vector<ClassInfo::ObjectMember>& members);
+
+private:
+	// Doubles, strings (size, characters and null character), data (size and bytes)
+	// and reference tables (index of the first reference in refs and count),
+	// at the offset given by the entry's payload
+	std::vector<uint8_t> bytes;
+	uint32_t unusedBytes = 0; // taken by replaced values
+	std::vector<GORef> refs; // ZGEOMREF values and ZGEOMREFTAB elements, at the index given by the payload
+	std::vector<DBLList> scripts; // SCRIPT values, at the index given by the payload
+	// Loaded DBL, holding the values whose payload has the SOURCE_VALUE bit,
+	// at the offset given by the rest of the payload, as stored in the file
+	const uint8_t* source = nullptr;
+	std::shared_ptr<const void> sourceKeeper;
+	static constexpr uint32_t SOURCE_VALUE = 0x80000000;
+
+	bool inSource(const DBLEntry& e) const { return e.payload & SOURCE_VALUE; }
+	const uint8_t* sourceValue(const DBLEntry& e) const { return source + (e.payload & ~SOURCE_VALUE); }
+	uint32_t addBytes(const void* data, size_t size);
+	uint32_t addString(std::string_view str);
+	// Adds the size and the data, followed by padding null bytes.
+	// The data can be a value of this list.
+	uint32_t addData(const void* data, size_t size, size_t padding = 0);
+	template <class T> T readBytes(uint32_t offset) const { T value; memcpy(&value, bytes.data() + offset, sizeof(T)); return value; }
+	uint32_t storedSize(const DBLEntry& e) const; // in bytes, 0 for values in the source
+	// Marks the previous value of e as unused, and removes the unused bytes if they take too much space
+	void replaced(const DBLEntry& e, uint32_t newOffset);
+	void compact();
+};
+
 struct GameObject
 {
 	std::string name;
@@ -148,6 +216,23 @@ struct GameObject
 	DBLList dbl;
 	std::shared_ptr<Chunk> excChunk;
 
+	// DBL and EXC as encoded by the last save, reused by the next saves while they are unchanged
+	struct SavedRecord {
+		std::string dbl;
+		std::vector<std::pair<uint32_t, GameObject*>> dblRefs; // offsets of the object IDs in dbl
+		uint64_t dblHash = 0;
+		std::string excData; // compared with excChunk on every save
+		uint64_t excHash = 0;
+	};
+	// Not copied along with the object
+	struct SaveCache {
+		std::unique_ptr<SavedRecord> record;
+		SaveCache() = default;
+		SaveCache(const SaveCache&) {}
+		SaveCache& operator=(const SaveCache&) { record.reset(); return *this; }
+	};
+	SaveCache saveCache;
+
 	//uint32_t refcount = 0;
 	size_t getRefCount() { return g_objRefCounts[this]; }
 
@@ -156,18 +241,65 @@ struct GameObject
 	~GameObject() = default;
 
 	std::string getPath() const;
+	// To call after modifying dbl, so that it is encoded again on the next save
+	void invalidateSaveCache() { saveCache.record.reset(); }
 };
 
 inline void GORef::deref() noexcept { if (m_obj) { g_objRefCounts[m_obj]--; m_obj = nullptr; } }
 inline void GORef::set(GameObject * obj) noexcept { deref(); m_obj = obj; if (m_obj) g_objRefCounts[m_obj]++; }
 
+// Progress of a scene being loaded on another thread, which can also be cancelled from there
+struct SceneLoadProgress {
+	enum Phase {
+		ZIP_READ,
+		PACK_INFLATE,
+		OBJECT_BUILD,
+		OBJECT_DECODE,
+		AUDIO,
+		TEXTURE_UPLOAD,
+		NUM_PHASES
+	};
+	std::atomic<int> phase = ZIP_READ;
+	std::atomic<size_t> itemsDone = 0, itemsTotal = 0; // in the current phase, total is 0 if unknown
+	std::atomic<bool> cancelRequested = false;
+
+	static const char* getPhaseName(int phase);
+	// Starts a new phase, or throws SceneLoadCancelled if cancellation was requested
+	void enter(Phase newPhase, size_t numItems = 0);
+	void checkCancel() const;
+	float getFraction() const;
+};
+
+struct SceneLoadCancelled : std::exception {
+	const char* what() const noexcept override { return "Scene loading was cancelled."; }
+};
+
 struct Scene {
-	Chunk oldSpkChunk;
+	// Storage of the chunk buffers created while loading, freed all at once when closing.
+	// Declared first so that it is destroyed after every chunk.
+	std::unique_ptr<Arena> bufferArena;
+	// Storage of the scene's objects, destroyed all at once before the arena
+	SlabPool<GameObject> objectPool;
+	// Pack.SPK as last loaded/saved, read through ChunkView.
+	// Shared with the meshes whose geometry still refers to it.
+	std::shared_ptr<const std::vector<uint8_t>> spkData;
 	GameObject* rootobj = nullptr, * cliprootobj = nullptr, * superroot = nullptr;
 	std::string lastspkfn;
 	std::vector<uint8_t> zipmem;
 	Chunk palPack, dxtPack, lgtPack, anmPack, wavPack;
 	bool hasAnmPack = false;
+	// The WAV pack stays compressed in zipmem until first accessed through getWavPack().
+	// The ANM pack is never edited, so it is only copied from zipmem when saving.
+	bool wavPackLoaded = true;
+	// Indices of the Repeat.* files that the packs were reconstructed from,
+	// keeping the files mapped and their regions known while the scene is open
+	struct RepeatIndices {
+		std::shared_ptr<RepeatIndex> pal, dxt, lgt, wav;
+	} repeatIndices;
+	// Packs modified since loading, the unmodified ones are copied from zipmem as they are when saving
+	struct DirtyPacks {
+		bool pal = false, dxt = false, lgt = false, wav = false, anm = false;
+	} dirtyPacks;
 	bool ready = false;
 	AudioManager audioMgr;
 
@@ -185,17 +317,51 @@ struct Scene {
 
 	std::vector<Chunk> remainingChunks; // such as PSCR
 
+	// Object references counted by LoadSceneData, added to g_objRefCounts by FinishLoading
+	std::vector<std::pair<GameObject*, uint32_t>> pendingRefCounts;
+
+	// Make objects with identical mesh geometry share the same Mesh when loading a scene.
+	// Saves memory and render preparation, but then editing one of these meshes changes all of them.
+	static inline bool mergeIdenticalMeshes = false;
+
+	// Throws c47editException if the pack can't be read
+	Chunk& getWavPack();
+
 	void LoadEmpty();
+	// Throws c47editException if the scene can't be read
 	void LoadSceneSPK(const char *fn);
-	Chunk ConstructSPK();
+	// Part of LoadSceneSPK that doesn't touch any global state, so it can run on another thread
+	void LoadSceneData(const char *fn, SceneLoadProgress* progress = nullptr);
+	// Rest of LoadSceneSPK, to be done on the main thread once LoadSceneData has finished
+	void FinishLoading();
+	// parallel: save the objects on all cores, the SPK is the same as with the serial way
+	Chunk ConstructSPK(bool parallel = true);
 	void SaveSceneSPK(const char *fn);
 	void Close();
-	~Scene() { Close(); }
+	Scene() = default;
+	Scene(Scene&&) = default;
+	// A member-wise assignment would free the arena first, while the objects and chunks
+	// allocated from it still exist, so the current scene is destroyed as a whole beforehand
+	Scene& operator=(Scene&& other);
+	~Scene() { if (ready) release(); }
 	
+	// Every object of the scene must be created and freed through these
+	template <class... Args> GameObject* newObject(Args&&... args) { return objectPool.create(std::forward<Args>(args)...); }
+	void deleteObject(GameObject* obj) { objectPool.destroy(obj); }
+	// Mesh, line or light for an object of the scene, allocated from the scene's arena
+	template <class T, class... Args> std::shared_ptr<T> newComponent(Args&&... args) {
+		BufferAllocator* source = bufferArena ? (BufferAllocator*)bufferArena.get() : BufferAllocator::heap();
+		return std::allocate_shared<T>(BufferStdAllocator<T>(source), std::forward<Args>(args)...);
+	}
+
 	GameObject* CreateObject(int type, GameObject* parent);
 	void RemoveObject(GameObject *o);
 	GameObject* DuplicateObject(GameObject *o, GameObject *parent = nullptr);
 	void GiveObject(GameObject *o, GameObject *t);
+
+private:
+	// Destroys the content of the scene, the arena last, leaving the scene moved-from
+	void release();
 };
 extern Scene g_scene;
 
@@ -5,9 +5,14 @@
 
 #pragma once
 
+#include <stdexcept>
+
 #ifndef APP_VERSION
 #define APP_VERSION "DEV"
 #endif
 
 [[noreturn]] void ferr(const char *str);
 void warn(const char *str);
+
+// Error that the editor reports to the user without closing
+class c47editException : public std::runtime_error { using std::runtime_error::runtime_error; };
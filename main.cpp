@@ -8,6 +8,7 @@
 #include <ctime>
 #include <filesystem>
 #include <functional>
+#include <future>
 #include <memory>
 #include <optional>
 
@@ -62,7 +63,7 @@ bool showInvisibleObjects = false;
 bool IsObjectVisible(GameObject* obj) {
 	if (!(obj->flags & 0x20))
 		return false;
-	if (!showInvisibleObjects && std::get<uint32_t>(obj->dbl.entries.at(9).value) != 0)
+	if (!showInvisibleObjects && obj->dbl.entries.at(9).payload != 0)
 		return false;
 	if (!showZGates && obj->type == 21)
 		return false;
@@ -189,8 +190,6 @@ void IGMessageValue(const char* name, uint32_t& ref)
 	}
 }
 
-class c47editException : public std::runtime_error { using std::runtime_error::runtime_error; };
-
 template <typename F>
 void VisitAudioObject(AudioObject* obj, const F& lambda) {
 	if (obj->getType() == WaveAudioObject::TYPEID)
@@ -230,10 +229,17 @@ void CopyObjectToAnotherScene(Scene& srcScene, Scene& destScene, GameObject* ogO
 
 	std::map<GameObject*, GameObject*> cloneMap;
 	auto walkObj = [&cloneMap,&destScene](GameObject* obj, GameObject* parent, auto& rec) -> void {
-		GameObject* clone = new GameObject(*obj);
+		GameObject* clone = destScene.newObject(*obj);
 		clone->subobj.clear();
 		clone->parent = parent;
 		clone->root = destScene.rootobj;
+		// the source scene's chunks can be freed with its arena, so the copy must not share them
+		if (clone->excChunk)
+			clone->excChunk = std::make_shared<Chunk>(*clone->excChunk);
+		if (clone->line)
+			clone->line = destScene.newComponent<ObjLine>(*clone->line);
+		if (clone->light)
+			clone->light = destScene.newComponent<Light>(*clone->light);
 		parent->subobj.push_back(clone);
 		cloneMap[obj] = clone;
 		for (GameObject* child : obj->subobj)
@@ -241,8 +247,10 @@ void CopyObjectToAnotherScene(Scene& srcScene, Scene& destScene, GameObject* ogO
 	};
 	walkObj(ogObject, destScene.rootobj, walkObj);
 
-	if (!srcScene.lgtPack.subchunks.empty() && destScene.lgtPack.subchunks.empty()) // TODO: Improve
+	if (!srcScene.lgtPack.subchunks.empty() && destScene.lgtPack.subchunks.empty()) { // TODO: Improve
 		destScene.lgtPack.subchunks.emplace_back(srcScene.lgtPack.subchunks[0]);
+		destScene.dirtyPacks.lgt = true;
+	}
 	std::map<int, int> textureMap;
 	auto fixref = [&cloneMap](GORef& ref) {
 		if (ref) {
@@ -255,9 +263,9 @@ void CopyObjectToAnotherScene(Scene& srcScene, Scene& destScene, GameObject* ogO
 	for (const auto& [obj, clone] : cloneMap) {
 		for (auto& de : clone->dbl.entries) {
 			if (de.type == DBLEntry::EType::ZGEOMREF)
-				fixref(std::get<GORef>(de.value));
+				fixref(clone->dbl.getRef(de));
 			else if (de.type == DBLEntry::EType::ZGEOMREFTAB)
-				for (auto& go : std::get<std::vector<GORef>>(de.value))
+				for (auto& go : clone->dbl.getRefTable(de))
 					fixref(go);
 			else if (de.type == DBLEntry::EType::SNDREF) {
 				std::function<void(AudioRef&)> fixAudioRef;
@@ -301,16 +309,20 @@ void CopyObjectToAnotherScene(Scene& srcScene, Scene& destScene, GameObject* ogO
 								}
 							}
 							// then do the copy
-							destScene.wavPack.subchunks.insert(destScene.wavPack.subchunks.begin() + destWaveIndex, srcScene.wavPack.subchunks.at(srcWaveIndex));
+							Chunk& destWavPack = destScene.getWavPack();
+							destWavPack.subchunks.insert(destWavPack.subchunks.begin() + destWaveIndex, srcScene.getWavPack().subchunks.at(srcWaveIndex));
+							destScene.dirtyPacks.wav = true;
 						}
 					}
 					aref.id = destId;
 				};
-				AudioRef& aref = std::get<AudioRef>(de.value);
+				AudioRef aref;
+				aref.id = de.payload;
 				fixAudioRef(aref);
+				de.payload = aref.id;
 			}
 			else if (de.type == DBLEntry::EType::MSG) {
-				uint32_t mid = std::get<uint32_t>(de.value);
+				uint32_t mid = de.payload;
 				if (mid != 0) {
 					auto& [name, desc] = srcScene.msgDefinitions.at(mid);
 					uint32_t destId = getMessageId(destScene, name);
@@ -318,13 +330,13 @@ void CopyObjectToAnotherScene(Scene& srcScene, Scene& destScene, GameObject* ogO
 						destId = destScene.msgDefinitions.empty() ? 1 : destScene.msgDefinitions.rbegin()->first + 1;
 						destScene.msgDefinitions[destId] = { name, desc };
 					}
-					de.value = destId;
+					de.payload = destId;
 				}
 			}
 		}
 
 		if (clone->mesh) {
-			clone->mesh = std::make_shared<Mesh>(*clone->mesh);
+			clone->mesh = destScene.newComponent<Mesh>(*clone->mesh);
 			for (auto& face : clone->mesh->ftxFaces) {
 				for (auto& [flag, index] : std::array<std::pair<int, int>, 2>{ { {0x20, 2}, { 0x80, 3 } }}) {
 					if ((face[0] & flag) && !(face[index] & 0x8000)) {
@@ -341,10 +353,12 @@ void CopyObjectToAnotherScene(Scene& srcScene, Scene& destScene, GameObject* ogO
 								auto& texCopyDxt = destScene.dxtPack.subchunks.emplace_back(*ogDxt);
 								*(uint32_t*)texCopyPal.maindata.data() = destScene.numTextures;
 								*(uint32_t*)texCopyDxt.maindata.data() = destScene.numTextures;
+								destScene.dirtyPacks.pal = destScene.dirtyPacks.dxt = true;
 							}
 							else {
 								auto& texCopyLgt = destScene.lgtPack.subchunks.emplace_back(*ogPal);
 								*(uint32_t*)texCopyLgt.maindata.data() = destScene.numTextures;
+								destScene.dirtyPacks.lgt = true;
 							}
 							textureMap[ogTexId] = destScene.numTextures;
 							face[index] = (uint16_t)destScene.numTextures;
@@ -404,8 +418,8 @@ void IGOTNode(GameObject *o)
 			auto fpath = GuiUtils::OpenDialogBox("Scene (*.zip)\0*.zip\0\0\0\0\0", "zip");
 			if (!fpath.empty()) {
 				Scene subscene;
-				subscene.LoadSceneSPK(fpath.string().c_str());
 				try {
+					subscene.LoadSceneSPK(fpath.string().c_str());
 					CopyObjectToAnotherScene(subscene, g_scene, subscene.rootobj->subobj.at(0));
 					UncacheAllTextures();
 					GlifyAllTextures();
@@ -471,13 +485,13 @@ constexpr uint32_t swap_rb(uint32_t a) { return (a & 0xFF00FF00) | ((a & 0xFF000
 GameObject *objtogive = 0;
 uint32_t curtexid = 0;
 
-std::vector<uint32_t> UnsplitDblImage(GameObject* obj, void* data, int type, int width, int height, bool opacity)
+std::vector<uint32_t> UnsplitDblImage(GameObject* obj, const void* data, int type, int width, int height, bool opacity)
 {
 	std::vector<uint32_t> unpacked(width * height, 0xFFFF00FF);
-	uint8_t* ptr = (uint8_t*)data;
-	auto read8 = [&ptr]() {uint8_t val = *(uint8_t*)ptr; ptr += 1; return val; };
-	auto read16 = [&ptr]() {int16_t val = *(int16_t*)ptr; ptr += 2; return val; };
-	auto read32 = [&ptr]() {int32_t val = *(int32_t*)ptr; ptr += 4; return val; };
+	const uint8_t* ptr = (const uint8_t*)data;
+	auto read8 = [&ptr]() {uint8_t val = *ptr; ptr += 1; return val; };
+	auto read16 = [&ptr]() {int16_t val = *(const int16_t*)ptr; ptr += 2; return val; };
+	auto read32 = [&ptr]() {int32_t val = *(const int32_t*)ptr; ptr += 4; return val; };
 	bool weird = false;
 	int numQuads = read32();
 	if (numQuads == 0x40000001) {
@@ -644,7 +658,7 @@ std::vector<uint8_t> SplitDblImage(uint32_t* image, int width, int height) {
 	return buffer;
 }
 
-GLuint GetDblImageTexture(GameObject* obj, void* data, int type, int width, int height, bool opacity, bool refresh) {
+GLuint GetDblImageTexture(GameObject* obj, const void* data, int type, int width, int height, bool opacity, bool refresh) {
 	static GameObject* previousObj = nullptr;
 	static GLuint tex = 0;
 	if (!refresh && obj == previousObj)
@@ -664,10 +678,11 @@ GLuint GetDblImageTexture(GameObject* obj, void* data, int type, int width, int
 
 static GameObject* nextobjtosel = 0;
 
-void IGDBLList(DBLList& dbl, const std::vector<ClassInfo::ObjectMember>& members)
+// Returns true if any value of the list was changed
+bool IGDBLList(DBLList& dbl, const std::vector<ClassInfo::ObjectMember>& members)
 {
 	size_t memberIndex = 0;
-	ImGui::InputScalar("DBL Flags", ImGuiDataType_U32, &dbl.flags);
+	bool changed = ImGui::InputScalar("DBL Flags", ImGuiDataType_U32, &dbl.flags);
 	int i = 0;
 	for (auto e = dbl.entries.begin(); e != dbl.entries.end(); e++)
 	{
@@ -688,43 +703,62 @@ void IGDBLList(DBLList& dbl, const std::vector<ClassInfo::ObjectMember>& members
 		{
 		case ET::UNDEFINED:
 			ImGui::Text("0"); break;
-		case ET::DOUBLE:
-			ImGui::InputDouble(name.c_str(), &std::get<double>(e->value)); break;
-		case ET::FLOAT:
-			ImGui::InputFloat(name.c_str(), &std::get<float>(e->value)); break;
+		case ET::DOUBLE: {
+			double val = dbl.getDouble(*e);
+			if (ImGui::InputDouble(name.c_str(), &val)) {
+				dbl.setDouble(*e, val);
+				changed = true;
+			}
+			break;
+		}
+		case ET::FLOAT: {
+			float val = e->getFloat();
+			if (ImGui::InputFloat(name.c_str(), &val)) {
+				e->setFloat(val);
+				changed = true;
+			}
+			break;
+		}
 		case ET::INT:
 		{
-			uint32_t& ref = std::get<uint32_t>(e->value);
+			uint32_t& ref = e->payload;
 			if (mem->type == "BOOL") {
 				bool val = ref;
-				if (ImGui::Checkbox(name.c_str(), &val))
+				if (ImGui::Checkbox(name.c_str(), &val)) {
 					ref = val ? 1 : 0;
+					changed = true;
+				}
 			}
 			else if (mem->type == "ENUM") {
 				if (ImGui::BeginCombo(name.c_str(), mem->valueChoices[ref].c_str())) {
 					for (size_t i = 0; i < mem->valueChoices.size(); ++i)
-						if (ImGui::Selectable(mem->valueChoices[i].c_str(), ref == (uint32_t)i))
+						if (ImGui::Selectable(mem->valueChoices[i].c_str(), ref == (uint32_t)i)) {
+							changed |= ref != (uint32_t)i;
 							ref = (uint32_t)i;
+						}
 					ImGui::EndCombo();
 				}
 			}
 			else {
-				ImGui::InputInt(name.c_str(), (int*)&ref);
+				changed |= ImGui::InputInt(name.c_str(), (int*)&ref);
 			}
 			break;
 		}
 		case ET::STRING:
 		case ET::FILE:
 		{
-			auto& str = std::get<std::string>(e->value);
+			std::string str(dbl.getString(*e));
 			//IGStdStringInput((e->type == 5) ? "Filename" : "String", str);
-			IGStdStringInput(name.c_str(), str);
+			if (IGStdStringInput(name.c_str(), str)) {
+				dbl.setString(*e, str);
+				changed = true;
+			}
 			break;
 		}
 		case ET::TERMINATOR:
 			ImGui::Separator(); break;
 		case ET::DATA: {
-			auto& data = std::get<std::vector<uint8_t>>(e->value);
+			auto data = dbl.getData(*e);
 			ImGui::Text("Data (%s): %zu bytes", name.c_str(), data.size());
 			ImGui::SameLine();
 			if (ImGui::SmallButton("Export")) {
@@ -740,26 +774,32 @@ void IGDBLList(DBLList& dbl, const std::vector<ClassInfo::ObjectMember>& members
 				fseek(file, 0, SEEK_END);
 				auto len = ftell(file);
 				fseek(file, 0, SEEK_SET);
-				data.resize(len);
-				fread(data.data(), data.size(), 1, file);
+				std::vector<uint8_t> imported(len);
+				fread(imported.data(), imported.size(), 1, file);
 				fclose(file);
+				dbl.setData(*e, imported.data(), imported.size());
+				data = dbl.getData(*e);
+				changed = true;
 			}
 			if (name == "Squares") {
-				std::string& name = std::get<std::string>((e + 1)->value);
-				uint32_t& width = std::get<uint32_t>((e + 2)->value);
-				uint32_t& height = std::get<uint32_t>((e + 3)->value);
-				uint32_t& picSplitX = std::get<uint32_t>((e + 4)->value);
-				uint32_t& picSplitY = std::get<uint32_t>((e + 5)->value);
-				uint32_t& opacity = std::get<uint32_t>((e + 6)->value);
-				uint32_t& format = std::get<uint32_t>((e + 12)->value);
-				uint32_t& picSize = std::get<uint32_t>((e + 13)->value);
+				std::string_view name = dbl.getString(*(e + 1));
+				uint32_t& width = (e + 2)->payload;
+				uint32_t& height = (e + 3)->payload;
+				uint32_t& picSplitX = (e + 4)->payload;
+				uint32_t& picSplitY = (e + 5)->payload;
+				uint32_t& opacity = (e + 6)->payload;
+				uint32_t& format = (e + 12)->payload;
+				uint32_t& picSize = (e + 13)->payload;
 				bool refresh = false;
 				if (ImGui::Button("Import image")) {
 					auto fpath = GuiUtils::OpenDialogBox("PNG Image\0*.png\0\0\0\0", "png");
 					if (!fpath.empty()) {
 						int impWidth, impHeight, impChannels;
 						auto image = stbi_load(fpath.string().c_str(), &impWidth, &impHeight, &impChannels, 4);
-						data = SplitDblImage((uint32_t*)image, impWidth, impHeight);
+						auto squares = SplitDblImage((uint32_t*)image, impWidth, impHeight);
+						dbl.setData(*e, squares.data(), squares.size());
+						data = dbl.getData(*e);
+						name = dbl.getString(*(e + 1));
 						width = impWidth;
 						height = impHeight;
 						picSplitX = 0;
@@ -768,6 +808,7 @@ void IGDBLList(DBLList& dbl, const std::vector<ClassInfo::ObjectMember>& members
 						picSize = 0;
 						stbi_image_free(image);
 						refresh = true;
+						changed = true;
 					}
 				}
 				if (!data.empty()) {
@@ -789,7 +830,7 @@ void IGDBLList(DBLList& dbl, const std::vector<ClassInfo::ObjectMember>& members
 			break;
 		}
 		case ET::ZGEOMREF:
-			if (auto& obj = std::get<GORef>(e->value); obj.valid()) {
+			if (auto& obj = dbl.getRef(*e); obj.valid()) {
 				ImGui::LabelText(name.c_str(), "Object %s::%s", ClassInfo::GetObjTypeString(obj->type), obj->name.c_str());
 				if (ImGui::IsItemClicked())
 					nextobjtosel = obj.get();
@@ -800,13 +841,14 @@ void IGDBLList(DBLList& dbl, const std::vector<ClassInfo::ObjectMember>& members
 			{
 				if (const ImGuiPayload* pl = ImGui::AcceptDragDropPayload("GameObject"))
 				{
-					e->value.emplace<GORef>(*(GameObject**)pl->Data);
+					dbl.getRef(*e) = *(GameObject**)pl->Data;
+					changed = true;
 				}
 				ImGui::EndDragDropTarget();
 			}
 			break;
 		case ET::ZGEOMREFTAB: {
-			auto& vec = std::get<std::vector<GORef>>(e->value);
+			auto vec = dbl.getRefTable(*e);
 			if (ImGui::BeginListBox("##Objlist", ImVec2(0, 64))) {
 				for (auto& obj : vec)
 				{
@@ -818,6 +860,7 @@ void IGDBLList(DBLList& dbl, const std::vector<ClassInfo::ObjectMember>& members
 						if (const ImGuiPayload* pl = ImGui::AcceptDragDropPayload("GameObject"))
 						{
 							obj = *(GameObject**)pl->Data;
+							changed = true;
 						}
 						ImGui::EndDragDropTarget();
 					}
@@ -828,28 +871,36 @@ void IGDBLList(DBLList& dbl, const std::vector<ClassInfo::ObjectMember>& members
 			}
 			break;
 		}
-		case ET::MSG:
-			IGMessageValue(name.c_str(), std::get<uint32_t>(e->value));
+		case ET::MSG: {
+			uint32_t previous = e->payload;
+			IGMessageValue(name.c_str(), e->payload);
+			changed |= e->payload != previous;
 			break;
+		}
 		case ET::SNDREF: {
-			IGAudioRef(name.c_str(), std::get<AudioRef>(e->value));
+			AudioRef aref;
+			aref.id = e->payload;
+			IGAudioRef(name.c_str(), aref);
+			changed |= aref.id != e->payload;
+			e->payload = aref.id;
 			break;
 		}
 		case ET::SCRIPT: {
 			ImGui::Indent();
 			static const ClassInfo::ClassMember scriptHeader[2] = { {"", "ScriptFile"}, {"", "ScriptMembers"} };
 			static const std::vector<ClassInfo::ObjectMember> oScriptHeader = { {&scriptHeader[0]}, {&scriptHeader[1]} };
-			IGDBLList(std::get<DBLList>(e->value), oScriptHeader);
+			changed |= IGDBLList(dbl.getScript(*e), oScriptHeader);
 			ImGui::Unindent();
 			break;
 		}
 		default:
-			ImGui::Text("Unknown type %u", e->type); break;
+			ImGui::Text("Unknown type %u", (unsigned)e->type); break;
 		}
 		if (mem->isProtected)
 			ImGui::EndDisabled();
 		ImGui::PopID();
 	}
+	return changed;
 }
 
 void IGObjectInfo()
@@ -914,21 +965,25 @@ void IGObjectInfo()
 				for (auto& [name, memlist] : g_classMemberLists) {
 					if (name.find('_') != name.npos) {
 						if (ImGui::MenuItem(name.c_str())) {
-							std::string& routstr = std::get<std::string>(selobj->dbl.entries[0].value);
+							std::string routstr(selobj->dbl.getString(selobj->dbl.entries[0]));
 							if (!routstr.empty())
 								routstr += ',';
 							routstr += name;
 							routstr += " 0";
+							selobj->dbl.setString(selobj->dbl.entries[0], routstr);
 							std::vector<ClassInfo::ObjectMember> objmems;
 							ClassInfo::AddDBLMemberInfo(objmems, memlist);
 							selobj->dbl.addMembers(objmems);
+							selobj->invalidateSaveCache();
 						}
 					}
 				}
 				ImGui::EndPopup();
 			}
 			auto members = ClassInfo::GetMemberNames(selobj);
-			IGDBLList(selobj->dbl, members);
+			// changed properties make the DBL be encoded again on the next save
+			if (IGDBLList(selobj->dbl, *members))
+				selobj->invalidateSaveCache();
 		}
 		if (selobj->mesh && ImGui::CollapsingHeader("Mesh"))
 		{
@@ -946,7 +1001,7 @@ void IGObjectInfo()
 				if (!filepath.empty()) {
 					if (auto optMesh = ImportWithAssimp(filepath)) {
 						if (!selobj->mesh)
-							selobj->mesh = std::make_shared<Mesh>();
+							selobj->mesh = g_scene.newComponent<Mesh>();
 						*selobj->mesh = std::move(optMesh->first);
 						if (optMesh->second) {
 							selobj->excChunk = std::make_shared<Chunk>(std::move(*optMesh->second));
@@ -1085,19 +1140,21 @@ void IGObjectInfo()
 				}
 				ImGui::EndPopup();
 			}
-			if (!selobj->mesh->ftxFaces.empty()) {
-				float* uvCoords = (float*)selobj->mesh->textureCoords.data();
-				float* uvCoords2 = (float*)selobj->mesh->lightCoords.data();
-				uint16_t* ftxFace = (uint16_t*)selobj->mesh->ftxFaces.data();
-				size_t numFaces = selobj->mesh->getNumQuads() + selobj->mesh->getNumTris();
+			// read through a const mesh, so that geometry still in the SPK isn't copied
+			const Mesh& ftxMesh = *selobj->mesh;
+			if (!ftxMesh.ftxFaces.empty()) {
+				const float* uvCoords = ftxMesh.textureCoords.data();
+				const float* uvCoords2 = ftxMesh.lightCoords.data();
+				const uint16_t* ftxFace = (const uint16_t*)ftxMesh.ftxFaces.data();
+				size_t numFaces = ftxMesh.getNumQuads() + ftxMesh.getNumTris();
 				size_t numTexFaces = 0, numLitFaces = 0;
-				for (auto& ftxFace : selobj->mesh->ftxFaces) {
+				for (const auto& ftxFace : ftxMesh.ftxFaces) {
 					if (ftxFace[0] & 0x20) ++numTexFaces;
 					if (ftxFace[0] & 0x80) ++numLitFaces;
 				}
-				ImGui::Text("Num     Faces:  %zu (%zu)", selobj->mesh->ftxFaces.size(), numFaces);
-				ImGui::Text("Num Tex Faces:  %zu (%zu)", selobj->mesh->textureCoords.size() / 8, numTexFaces);
-				ImGui::Text("Num Lit Faces:  %zu (%zu)", selobj->mesh->lightCoords.size() / 8, numLitFaces);
+				ImGui::Text("Num     Faces:  %zu (%zu)", ftxMesh.ftxFaces.size(), numFaces);
+				ImGui::Text("Num Tex Faces:  %zu (%zu)", ftxMesh.textureCoords.size() / 8, numTexFaces);
+				ImGui::Text("Num Lit Faces:  %zu (%zu)", ftxMesh.lightCoords.size() / 8, numLitFaces);
 				ImGui::Separator();
 				for (size_t i = 0; i < numFaces; ++i) {
 					ImGui::Text("%04X %04X %04X %04X %04X %04X", ftxFace[0], ftxFace[1], ftxFace[2], ftxFace[3], ftxFace[4], ftxFace[5]);
@@ -1131,8 +1188,9 @@ void IGObjectInfo()
 					FILE* file;
 					_wfopen_s(&file, fpath.c_str(), L"wb");
 					if (file) {
-						auto str = selobj->excChunk->saveToString();
-						fwrite(str.data(), str.size(), 1, file);
+						selobj->excChunk->save([file](const void* data, size_t length) {
+							fwrite(data, length, 1, file);
+						});
 						fclose(file);
 					}
 				}
@@ -1240,6 +1298,7 @@ void IGTextures()
 				uint32_t tid = *(uint32_t*)palchk->maindata.data();
 				ImportTexture(fpath, *palchk, *dxtchk, tid);
 				InvalidateTexture(tid);
+				g_scene.dirtyPacks.pal = g_scene.dirtyPacks.dxt = true;
 			}
 		}
 	}
@@ -1327,7 +1386,8 @@ void IGTextures()
 			ImGui::Text("ID: %i\nSize: %i*%i\nNum mipmaps: %i\nFlags: %08X\nUnknown: %08X\nName: %s", ti->id, ti->width, ti->height, ti->numMipmaps, ti->flags, ti->random, ti->name);
 			auto conform = getConformanceLevel(ti->width, ti->height);
 			ImGui::TextColored(conformanceColor[conform], "%s", conformanceText[conform]);
-			ImGui::Image(texmap.at(curtexid), ImVec2(ti->width, ti->height));
+			auto t = texmap.find(curtexid); // might still be waiting to be uploaded
+			ImGui::Image((t != texmap.end()) ? t->second : nullptr, ImVec2(ti->width, ti->height));
 		}
 		ImGui::EndTable();
 	}
@@ -1339,6 +1399,19 @@ void IGSounds()
 {
 	static int selectedSoundId = -1;
 
+	// the WAV pack is read on first access, which can fail
+	Chunk* wavPack;
+	try {
+		wavPack = &g_scene.getWavPack();
+	}
+	catch (const c47editException& exc) {
+		std::string msg = "Failed to read the sounds!\nReason: ";
+		msg += exc.what();
+		warn(msg.c_str());
+		wndShowSounds = false;
+		return;
+	}
+
 	auto getWaveDataIndex = [](WaveAudioObject* wave) {
 		int index = 0;
 		for (auto& ptr : g_scene.audioMgr.audioObjects) {
@@ -1359,7 +1432,7 @@ void IGSounds()
 	if (ImGui::Button("Replace")) {
 		auto fpath = GuiUtils::OpenDialogBox("Sound Wave file (*.wav)\0*.WAV\0\0\0", "wav");
 		if (!fpath.empty()) {
-			Chunk& chk = g_scene.wavPack.subchunks[selectedWaveIndex];
+			Chunk& chk = wavPack->subchunks[selectedWaveIndex];
 			FILE* file;
 			_wfopen_s(&file, fpath.c_str(), L"rb");
 			if (file) {
@@ -1369,6 +1442,7 @@ void IGSounds()
 				chk.maindata.resize(len);
 				fread(chk.maindata.data(), len, 1, file);
 				fclose(file);
+				g_scene.dirtyPacks.wav = true;
 			}
 		}
 	}
@@ -1377,7 +1451,7 @@ void IGSounds()
 		const char* sndName = g_scene.audioMgr.audioNames[selectedSoundId].c_str();
 		auto fpath = GuiUtils::SaveDialogBox("Sound Wave file (*.wav)\0*.WAV\0\0\0", "wav", std::filesystem::path(sndName).filename());
 		if (!fpath.empty()) {
-			Chunk& chk = g_scene.wavPack.subchunks[selectedWaveIndex];
+			Chunk& chk = wavPack->subchunks[selectedWaveIndex];
 			FILE* file;
 			_wfopen_s(&file, fpath.c_str(), L"wb");
 			if (file) {
@@ -1396,7 +1470,7 @@ void IGSounds()
 				auto& name = g_scene.audioMgr.audioNames[id];
 				if (ptr && ptr->getType() == WaveAudioObject::TYPEID) {
 					WaveAudioObject* wave = (WaveAudioObject*)ptr.get();
-					Chunk& chk = g_scene.wavPack.subchunks[getWaveDataIndex(wave)];
+					Chunk& chk = wavPack->subchunks[getWaveDataIndex(wave)];
 					auto fpath = dirpath / std::filesystem::path(name).relative_path();
 					std::filesystem::create_directories(fpath.parent_path());
 					FILE* file;
@@ -1415,7 +1489,7 @@ void IGSounds()
 		auto& name = g_scene.audioMgr.audioNames[id];
 		if (ptr && ptr->getType() == WaveAudioObject::TYPEID) {
 			WaveAudioObject* wave = (WaveAudioObject*)ptr.get();
-			Chunk& chk = g_scene.wavPack.subchunks[getWaveDataIndex(wave)];
+			Chunk& chk = wavPack->subchunks[getWaveDataIndex(wave)];
 			ImGui::PushID(id);
 			if (ImGui::Selectable("##Sound", selectedSoundId == id)) {
 				selectedSoundId = id;
@@ -1512,13 +1586,11 @@ void IGAudioObjects()
 
 void IGZDefines()
 {
-	auto classMembers = ClassInfo::ProcessClassMemberListString(g_scene.zdefTypes);
-	std::vector<ClassInfo::ObjectMember> members;
-	ClassInfo::AddDBLMemberInfo(members, classMembers);
+	auto members = ClassInfo::GetListMemberNames(g_scene.zdefTypes);
 
 	nextobjtosel = nullptr;
 	ImGui::Begin("ZDefines", &wndShowZDefines);
-	IGDBLList(g_scene.zdefValues, members);
+	IGDBLList(g_scene.zdefValues, *members);
 	ImGui::End();
 	if (nextobjtosel)
 		selobj = nextobjtosel;
@@ -1553,7 +1625,7 @@ void RenderObject(GameObject *o, const Matrix& parentTransform)
 Vector3 finalintersectpnt = Vector3(0, 0, 0);
 
 template <int numverts>
-bool IsRayIntersectingFace(const Vector3& raystart, const Vector3& raydir, float* bver, uint16_t* bfac, const Matrix& worldmtx)
+bool IsRayIntersectingFace(const Vector3& raystart, const Vector3& raydir, const float* bver, const uint16_t* bfac, const Matrix& worldmtx)
 {
 	Vector3 pnts[numverts];
 	for (int i = 0; i < 3; i++)
@@ -1609,8 +1681,8 @@ GameObject *IsRayIntersectingObject(const Vector3& raystart, const Vector3& rayd
 	Matrix objmtx = o->matrix * worldmtx;
 	if (o->mesh && IsObjectVisible(o))
 	{
-		Mesh *m = o->mesh.get();
-		float* vertices = (o->excChunk && o->excChunk->findSubchunk('LCHE')) ? ApplySkinToMesh(m, o->excChunk.get()) : m->vertices.data();
+		const Mesh *m = o->mesh.get();
+		const float* vertices = (o->excChunk && o->excChunk->findSubchunk('LCHE')) ? ApplySkinToMesh(m, o->excChunk.get()) : m->vertices.data();
 		for (size_t i = 0; i < m->getNumQuads(); i++)
 			if (IsRayIntersectingFace<4>(raystart, raydir, vertices, m->quadindices.data() + i * 4, objmtx))
 				if ((d = (finalintersectpnt - campos).sqlen2xz()) < bestpickdist)
@@ -1644,17 +1716,80 @@ void UIClean()
 	nextobjtosel = nullptr;
 }
 
+// Scene being loaded in the background, swapped into g_scene once done
+struct SceneLoader {
+	std::unique_ptr<Scene> scene = std::make_unique<Scene>();
+	SceneLoadProgress progress;
+	std::future<void> result;
+};
+std::unique_ptr<SceneLoader> g_sceneLoader;
+
 bool CmdOpenScene()
 {
+	if (g_sceneLoader)
+		return false;
 	auto zipPath = GuiUtils::OpenDialogBox("Scene ZIP archive\0*.zip\0\0\0", "zip", "Select a Scene ZIP archive (containing Pack.SPK)");
 	if (zipPath.empty())
 		return false;
-	UIClean();
-	g_scene.LoadSceneSPK(zipPath.string().c_str());
-	GlifyAllTextures();
+	auto loader = std::make_unique<SceneLoader>();
+	loader->result = std::async(std::launch::async, [scene = loader->scene.get(), progress = &loader->progress, path = zipPath.string()]() {
+		scene->LoadSceneData(path.c_str(), progress);
+	});
+	g_sceneLoader = std::move(loader);
 	return true;
 }
 
+// Called every frame: swaps the loaded scene into g_scene when it's ready,
+// then uploads its textures a few at a time
+void PollSceneLoading()
+{
+	if (g_sceneLoader && g_sceneLoader->result.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		std::unique_ptr<SceneLoader> loader = std::move(g_sceneLoader);
+		try {
+			loader->result.get();
+			UIClean();
+			g_scene.Close();
+			g_scene = std::move(*loader->scene);
+			g_scene.FinishLoading();
+			QueueAllTextures();
+		}
+		catch (const SceneLoadCancelled&) {
+			loader->scene->FinishLoading();
+		}
+		catch (const std::exception& exc) {
+			loader->scene->FinishLoading();
+			std::string msg = "Failed to open scene!\nReason: ";
+			msg += exc.what();
+			MessageBoxA(hWindow, msg.c_str(), "c47edit", 16);
+		}
+	}
+	GlifyQueuedTextures(8.0);
+}
+
+void IGSceneLoading()
+{
+	auto [texturesDone, texturesTotal] = GetQueuedTexturesProgress();
+	if (!g_sceneLoader && texturesDone == texturesTotal)
+		return;
+	ImGui::SetNextWindowPos(ImVec2(screen_width * 0.5f, screen_height * 0.5f), ImGuiCond_Always, ImVec2(0.5f, 0.5f));
+	ImGui::Begin("Loading scene", nullptr, ImGuiWindowFlags_NoDocking | ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoSavedSettings);
+	if (g_sceneLoader) {
+		SceneLoadProgress& progress = g_sceneLoader->progress;
+		ImGui::TextUnformatted(SceneLoadProgress::getPhaseName(progress.phase));
+		ImGui::ProgressBar(progress.getFraction(), ImVec2(300.0f, 0.0f));
+		if (progress.cancelRequested)
+			ImGui::TextUnformatted("Cancelling...");
+		else if (ImGui::Button("Cancel"))
+			progress.cancelRequested = true;
+	}
+	else {
+		ImGui::TextUnformatted(SceneLoadProgress::getPhaseName(SceneLoadProgress::TEXTURE_UPLOAD));
+		float fraction = (SceneLoadProgress::TEXTURE_UPLOAD + (float)texturesDone / (float)texturesTotal) / SceneLoadProgress::NUM_PHASES;
+		ImGui::ProgressBar(fraction, ImVec2(300.0f, 0.0f));
+	}
+	ImGui::End();
+}
+
 void CmdNewScene()
 {
 	if (MessageBoxW(hWindow, L"Create a new empty scene?", L"c47edit", MB_ICONWARNING | MB_YESNO) == IDYES) {
@@ -1691,11 +1826,13 @@ int WINAPI WinMain(HINSTANCE hInst, HINSTANCE hPrevInst, char *args, int winmode
 	ImGui_ImplOpenGL2_Init();
 	lastfpscheck = GetTickCount();
 
-	if (!CmdOpenScene())
-		g_scene.LoadEmpty();
+	// the chosen scene is loaded in the background, the empty one is shown meanwhile
+	g_scene.LoadEmpty();
+	CmdOpenScene();
 
 	while (appnoquit = HandleWindow())
 	{
+		PollSceneLoading();
 		if (win_minimized)
 			Sleep(100);
 		else
@@ -1785,6 +1922,7 @@ int WINAPI WinMain(HINSTANCE hInst, HINSTANCE hPrevInst, char *args, int winmode
 			}
 
 			IGMain();
+			IGSceneLoading();
 			IGObjectTree();
 			IGObjectInfo();
 #ifndef APPVEYOR
@@ -1803,6 +1941,8 @@ int WINAPI WinMain(HINSTANCE hInst, HINSTANCE hPrevInst, char *args, int winmode
 					if (ImGui::MenuItem("Save as..."))
 						CmdSaveScene();
 					ImGui::Separator();
+					ImGui::MenuItem("Merge identical meshes on open", nullptr, &Scene::mergeIdenticalMeshes);
+					ImGui::Separator();
 					if (ImGui::MenuItem("Exit"))
 						DestroyWindow(hWindow);
 					ImGui::EndMenu();
@@ -1939,4 +2079,11 @@ int WINAPI WinMain(HINSTANCE hInst, HINSTANCE hPrevInst, char *args, int winmode
 			}
 		}
 	}
+
+	// stop a scene still being loaded
+	if (g_sceneLoader) {
+		g_sceneLoader->progress.cancelRequested = true;
+		g_sceneLoader->result.wait();
+		g_sceneLoader->scene->FinishLoading();
+	}
 }
\ No newline at end of file
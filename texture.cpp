@@ -1,6 +1,7 @@
 #include "texture.h"
 
 #include <cassert>
+#include <chrono>
 #include <filesystem>
 #include <functional>
 #include <map>
@@ -42,6 +43,10 @@ void GlifyTexture(Chunk* c) {
 	}
 
 	GLuint gltex;
+	if (auto it = texmap.find(texid); it != texmap.end()) {
+		gltex = (GLuint)(uintptr_t)it->second;
+		glDeleteTextures(1, &gltex);
+	}
 	glGenTextures(1, &gltex);
 	glBindTexture(GL_TEXTURE_2D, gltex);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (nmipmaps > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
@@ -80,15 +85,51 @@ void GlifyAllTextures()
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+// Next textures to upload in the PAL and LGT packs, if queued
+static bool texturesQueued = false;
+static size_t nextQueuedPalTexture = 0, nextQueuedLgtTexture = 0;
+
+void QueueAllTextures()
+{
+	texturesQueued = true;
+	nextQueuedPalTexture = nextQueuedLgtTexture = 0;
+}
+
+bool GlifyQueuedTextures(double timeBudgetMs)
+{
+	if (!texturesQueued)
+		return true;
+	auto startTime = std::chrono::steady_clock::now();
+	for (auto [pack, next] : { std::make_pair(&g_scene.palPack, &nextQueuedPalTexture), std::make_pair(&g_scene.lgtPack, &nextQueuedLgtTexture) }) {
+		while (*next < pack->subchunks.size()) {
+			if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count() >= timeBudgetMs) {
+				glBindTexture(GL_TEXTURE_2D, 0);
+				return false;
+			}
+			GlifyTexture(&pack->subchunks[(*next)++]);
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	texturesQueued = false;
+	return true;
+}
+
+std::pair<size_t, size_t> GetQueuedTexturesProgress()
+{
+	size_t total = g_scene.palPack.subchunks.size() + g_scene.lgtPack.subchunks.size();
+	if (!texturesQueued)
+		return { total, total };
+	return { nextQueuedPalTexture + nextQueuedLgtTexture, total };
+}
+
 void InvalidateTexture(uint32_t texid)
 {
-	GLuint gltex = (GLuint)(uintptr_t)texmap.at(texid);
-	glDeleteTextures(1, &gltex);
 	GlifyTexture(FindTextureChunk(g_scene, texid).first);
 }
 
 void UncacheAllTextures()
 {
+	texturesQueued = false;
 	for (auto& [id, vtex] : texmap) {
 		GLuint gltex = (GLuint)(uintptr_t)vtex;
 		glDeleteTextures(1, &gltex);
@@ -99,6 +140,7 @@ void UncacheAllTextures()
 std::tuple<uint32_t, Chunk*, Chunk*> AddUninitializedTexture(Scene& scene)
 {
 	uint32_t texId = ++scene.numTextures;
+	scene.dirtyPacks.pal = scene.dirtyPacks.dxt = true;
 	Chunk& chk = scene.palPack.subchunks.emplace_back();
 	Chunk& dxtchk = scene.dxtPack.subchunks.emplace_back();
 	return { texId, &chk, &dxtchk };
@@ -26,6 +26,11 @@ extern std::map<uint32_t, void*> texmap;
 
 void GlifyTexture(Chunk* c);
 void GlifyAllTextures();
+// Gradual alternative to GlifyAllTextures: uploads the queued textures of g_scene
+// for a limited time per call, so that it can be spread over several frames
+void QueueAllTextures();
+bool GlifyQueuedTextures(double timeBudgetMs);
+std::pair<size_t, size_t> GetQueuedTexturesProgress(); // number of uploaded, total
 void InvalidateTexture(uint32_t texid);
 void UncacheAllTextures();
 uint32_t AddTexture(Scene& scene, uint8_t* pixels, int width, int height, std::string_view name);
@@ -196,10 +196,10 @@ struct ProMesh {
 	};
 	std::map<PartKey, Part> parts;
 
-	inline static std::map<Mesh*, ProMesh> g_proMeshes;
+	inline static std::map<const Mesh*, ProMesh> g_proMeshes;
 
 	// Get a prepared mesh from the cache, make one if not already done
-	static ProMesh* getProMesh(Mesh* mesh, Chunk* excChunk) {
+	static ProMesh* getProMesh(const Mesh* mesh, Chunk* excChunk) {
 		// If ProMesh found in the cache, return it
 		auto it = g_proMeshes.find(mesh);
 		if (it != g_proMeshes.end())
@@ -240,7 +240,7 @@ struct ProMesh {
 			colorMap = (uint32_t*)colorMapData;
 		}
 
-		auto nextFace = [&](int shape, ProMesh::IndexType* indices) {
+		auto nextFace = [&](int shape, const ProMesh::IndexType* indices) {
 			bool isTextured = hasFtx && (ftxFace[0] & 0x20);
 			bool isLit = hasFtx && (ftxFace[0] & 0x80);
 			uint16_t texid = isTextured ? ftxFace[2] : 0xFFFF;
@@ -285,7 +285,7 @@ struct ProMesh {
 
 std::map<ProMesh::PartKey, std::vector<std::pair<Matrix, const ProMesh::Part*>>> g_meshLists;
 
-void DrawMesh(Mesh* mesh, const Matrix& matrix, Chunk* excChunk)
+void DrawMesh(const Mesh* mesh, const Matrix& matrix, Chunk* excChunk)
 {
 	if (!rendertextures)
 	{
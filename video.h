@@ -21,7 +21,7 @@ void EndDrawing();
 float* ApplySkinToMesh(const Mesh* mesh, Chunk* excChunk);
 void BeginMeshDraw();
 void EndMeshDraw();
-void DrawMesh(Mesh* mesh, const Matrix& matrix, Chunk* excChunk = nullptr);
+void DrawMesh(const Mesh* mesh, const Matrix& matrix, Chunk* excChunk = nullptr);
 void RenderMeshLists();
 void InvalidateMesh(Mesh* mesh);
 void UncacheAllMeshes();